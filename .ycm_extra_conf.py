@@ -46,7 +46,6 @@ flags = [
 '-std=c++0x',
 '-Isrc/include',
 '-Ilib/libcuckoo',
-'-Ilib/interval_tree',
 '-Ilib/lemon',
 '-Ilib/minimap2',
 # ...and the same thing goes for the magic -x option which specifies the
@@ -37,11 +37,14 @@ def check_binaries():
 
 
 
-def assemble(args, run_params, out_file, log_file, config_path):
+def assemble(args, run_params, out_file, log_file, config_path,
+             checkpoint_file=None):
     logger.info("Assembling disjointigs")
     logger.debug("-----Begin assembly log------")
     cmdline = [ASSEMBLE_BIN, "assemble", "--reads", ",".join(args.reads), "--out-asm", out_file,
                "--config", config_path, "--log", log_file, "--threads", str(args.threads)]
+    if checkpoint_file:
+        cmdline.extend(["--checkpoint", checkpoint_file])
     if args.debug:
         cmdline.append("--debug")
     if args.meta:
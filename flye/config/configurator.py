@@ -9,12 +9,13 @@ Sets up some parameters for the run based on input
 from __future__ import absolute_import
 from __future__ import division
 import logging
+import os
+import subprocess
 
-import flye.utils.fasta_parser as fp
 import flye.config.py_cfg as cfg
-from flye.six import iteritems
 
 
+STATS_BIN = "flye-modules"
 logger = logging.getLogger()
 
 
@@ -27,30 +28,28 @@ def setup_params(args):
     parameters = {}
     parameters["pipeline_version"] = cfg.vals["pipeline_version"]
 
-    total_length = 0
-    read_lengths = []
     MAX_READ_LEN = 2 ** 31 - 1
 
     lowest_read_len = cfg.vals["min_overlap_range"][args.read_type][0]
     if args.min_overlap:
         lowest_read_len = args.min_overlap
-    passing_reads = 0
 
-    for read_file in args.reads:
-        for _, seq_len in iteritems(fp.read_sequence_lengths(read_file)):
-            if seq_len > MAX_READ_LEN:
-                raise ConfigException("Length of single read in '{}' exceeded maximum ({})".format(read_file, MAX_READ_LEN))
-            if seq_len > lowest_read_len:
-                passing_reads += 1
+    target_length = None
+    if args.asm_coverage:
+        target_length = args.genome_size * args.asm_coverage
+    stats = _read_statistics(args, lowest_read_len, target_length)
 
-            total_length += seq_len
-            read_lengths.append(seq_len)
-
-    if not passing_reads:
+    if stats["max_read_length"] > MAX_READ_LEN:
+        raise ConfigException("Length of single read exceeded maximum ({})".format(MAX_READ_LEN))
+    if not stats["passing_reads"]:
         raise ConfigException("No reads above minimum length threshold ({})".format(lowest_read_len))
+    if stats["non_acgt_reads"]:
+        logger.warning("Input contain non-ACGT characters - "
+                       "they will be converted to arbitrary ACGTs")
 
-    _, reads_n50 = _calc_nx(read_lengths, total_length, 0.50)
-    _, reads_n90 = _calc_nx(read_lengths, total_length, 0.90)
+    total_length = stats["total_length"]
+    reads_n50 = stats["reads_n50"]
+    reads_n90 = stats["reads_n90"]
 
     #Selecting minimum overlap
     logger.info("Total read length: %d", total_length)
@@ -92,8 +91,7 @@ def setup_params(args):
 
     if target_cov:
         logger.info("Using longest %dx reads for contig assembly", target_cov)
-        min_read = _get_downsample_threshold(read_lengths,
-                                             args.genome_size * target_cov)
+        min_read = stats["downsample_cutoff"]
         logger.debug("Min read length cutoff: %d", min_read)
         parameters["min_read_length"] = min_read
     else:
@@ -102,24 +100,29 @@ def setup_params(args):
     return parameters
 
 
-def _calc_nx(scaffolds_lengths, assembly_len, rate):
-    n50 = 0
-    sum_len = 0
-    l50 = 0
-    for l in sorted(scaffolds_lengths, reverse=True):
-        sum_len += l
-        l50 += 1
-        if sum_len > rate * assembly_len:
-            n50 = l
-            break
-    return l50, n50
-
-
-def _get_downsample_threshold(read_lengths, target_len):
-    sum_len = 0
-    for l in sorted(read_lengths, reverse=True):
-        sum_len += l
-        if sum_len > target_len:
-            return l
-
-    return 0
+def _read_statistics(args, min_length, target_length):
+    """
+    Runs the native read statistics pass and parses its report:
+    read length N50/N90, total length and the downsampling cutoff
+    """
+    report_file = os.path.join(args.out_dir, "read_stats.txt")
+    cmdline = [STATS_BIN, "read-stats", "--reads", ",".join(args.reads),
+               "--out", report_file, "--min-length", str(min_length),
+               "--log", args.log_file, "--threads", str(args.threads)]
+    if target_length:
+        cmdline.extend(["--target-length", str(target_length)])
+    if args.debug:
+        cmdline.append("--debug")
+
+    try:
+        logger.debug("Running: " + " ".join(cmdline))
+        subprocess.check_call(cmdline)
+    except (subprocess.CalledProcessError, OSError) as e:
+        raise ConfigException("Error collecting read statistics: " + str(e))
+
+    stats = {}
+    with open(report_file, "r") as f:
+        for line in f:
+            fields = line.split()
+            stats[fields[0]] = int(fields[1])
+    return stats
@@ -38,6 +38,11 @@ vals = {
         "max_bubble_branches" : 50,
         "max_read_coverage" : 1000,
         "min_polish_aln_len" : 500,
+        #assemblies longer than this are polished in batches of regions
+        "polish_region_len" : 100000000,
+        "polish_region_overlap" : 50000,
+        #memory budget (Mb) for the in-memory alignment buckets
+        "polish_align_memory" : 4096,
 
         #final coverage filtering
         "relative_minimum_coverage" : 5,
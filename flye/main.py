@@ -109,13 +109,20 @@ class JobAssembly(Job):
         self.assembly_filename = os.path.join(self.assembly_dir,
                                               "draft_assembly.fasta")
         self.out_files["assembly"] = self.assembly_filename
+        self.checkpoint_filename = os.path.join(self.assembly_dir,
+                                                "assembly_checkpoint")
 
     def run(self):
         super(JobAssembly, self).run()
         if not os.path.isdir(self.assembly_dir):
             os.mkdir(self.assembly_dir)
+        #checkpoints left by a previous run are only used when resuming
+        if (not (self.args.resume or self.args.resume_from) and
+                os.path.exists(self.checkpoint_filename)):
+            os.remove(self.checkpoint_filename)
         asm.assemble(self.args, Job.run_params, self.assembly_filename,
-                     self.log_file, self.args.asm_config, )
+                     self.log_file, self.args.asm_config,
+                     self.checkpoint_filename)
         if os.path.getsize(self.assembly_filename) == 0:
             raise asm.AssembleException("No disjointigs were assembled - "
                                         "please check if the read type and genome "
@@ -26,6 +26,9 @@ from flye.six.moves import zip
 
 logger = logging.getLogger()
 
+#contig windows that are processed independently
+CHUNK_SIZE = 1000000
+
 
 class ProfileInfo(object):
     __slots__ = ("nucl", "insertions", "propagated_ins", "num_deletions",
@@ -113,8 +116,6 @@ def make_bubbles(alignment_path, contigs_info, contigs_path,
     """
     The main function: takes an alignment and returns bubbles
     """
-    CHUNK_SIZE = 1000000
-
     contigs_fasta = fp.read_sequence_dict(contigs_path)
     manager = multiprocessing.Manager()
     aln_reader = SynchronizedSamReader(alignment_path, contigs_fasta, manager,
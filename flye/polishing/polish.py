@@ -15,8 +15,8 @@ from collections import defaultdict
 
 from flye.polishing.alignment import (make_alignment, get_contigs_info,
                                       merge_chunks, split_into_chunks)
-from flye.utils.sam_parser import SynchronizedSamReader
-from flye.polishing.bubbles import make_bubbles
+from flye.utils.sam_parser import SynchronizedSamReader, ContigRegion
+from flye.polishing.bubbles import make_bubbles, CHUNK_SIZE
 import flye.utils.fasta_parser as fp
 from flye.utils.utils import which
 import flye.config.py_cfg as cfg
@@ -73,31 +73,73 @@ def polish(contig_seqs, read_seqs, work_dir, num_iters, num_threads, read_platfo
     for i in range(num_iters):
         logger.info("Polishing genome (%d/%d)", i + 1, num_iters)
 
-        ####
+        #Large assemblies are polished in batches of contig regions,
+        #so that the alignment and bubbles of a single batch fit into
+        #the memory and disk budget
+        ctg_lengths = fp.read_sequence_lengths(prev_assembly)
         if not bam_input:
-            logger.info("Running minimap2")
-            alignment_file = os.path.join(work_dir, "minimap_{0}.bam".format(i + 1))
-            make_alignment(prev_assembly, read_seqs, num_threads,
-                           work_dir, read_platform, alignment_file,
-                           reference_mode=True, sam_output=True)
+            batches = _split_into_regions(ctg_lengths, cfg.vals["polish_region_len"],
+                                          cfg.vals["polish_region_overlap"])
         else:
             logger.info("Polishing with provided bam")
-            alignment_file = read_seqs[0]
-
-        #####
-        logger.info("Separating alignment into bubbles")
-        contigs_info = get_contigs_info(prev_assembly)
-        bubbles_file = os.path.join(work_dir,
-                                    "bubbles_{0}.fasta".format(i + 1))
-        coverage_stats, mean_aln_error = \
-            make_bubbles(alignment_file, contigs_info, prev_assembly,
-                         read_platform, num_threads,
-                         bubbles_file)
-
-        logger.info("Alignment error rate: %f", mean_aln_error)
-        consensus_out = os.path.join(work_dir, "consensus_{0}.fasta".format(i + 1))
+            batches = None
+
+        if batches is None or len(batches) == 1:
+            batch_files = [prev_assembly]
+            region_map = {}
+        else:
+            logger.info("Splitting contigs into %d batches of regions", len(batches))
+            batch_files, region_map = _write_region_batches(prev_assembly, batches,
+                                                            work_dir)
+
+        region_consensus = defaultdict(list)
+        region_coverage = defaultdict(list)
+        total_aln_error = 0
+        total_length = 0
+        for batch_id, batch_fasta in enumerate(batch_files):
+            if len(batch_files) > 1:
+                logger.info("Polishing batch %d/%d", batch_id + 1, len(batch_files))
+            suffix = "{0}_{1}".format(i + 1, batch_id + 1) if len(batch_files) > 1 \
+                     else str(i + 1)
+
+            #reads are mapped against the batch sequences only, and
+            #the alignment is removed before the next batch starts
+            if not bam_input:
+                logger.info("Running minimap2")
+                alignment_file = os.path.join(work_dir, "minimap_{0}.bkt".format(suffix))
+                _run_align_bin(batch_fasta, read_seqs, read_platform,
+                               alignment_file, num_threads)
+            else:
+                alignment_file = read_seqs[0]
+
+            batch_result = _polish_batch(alignment_file, batch_fasta, work_dir, suffix,
+                                         read_platform, subs_matrix, hopo_matrix,
+                                         num_threads, output_progress, use_hopo)
+            if not bam_input:
+                os.remove(alignment_file)
+                os.remove(alignment_file + ".idx")
+            if region_map:
+                os.remove(batch_fasta)
+            if batch_result is None:
+                continue
+
+            consensus, batch_coverage, batch_lengths, batch_error = batch_result
+            for region_name, bubbles in iteritems(consensus):
+                if region_map:
+                    ctg_id, region_start, region_end = region_map[region_name]
+                else:
+                    ctg_id, region_start, region_end = \
+                        region_name, 0, ctg_lengths[region_name]
+                region_consensus[ctg_id].append((region_start, region_end, bubbles))
+                region_coverage[ctg_id].append((batch_coverage[region_name],
+                                                batch_lengths[region_name]))
+            batch_length = sum(batch_lengths.values())
+            total_aln_error += batch_error * batch_length
+            total_length += batch_length
+
+        logger.info("Alignment error rate: %f", total_aln_error / max(total_length, 1))
         polished_file = os.path.join(work_dir, "polished_{0}.fasta".format(i + 1))
-        if os.path.getsize(bubbles_file) == 0:
+        if not region_consensus:
             logger.info("No reads were aligned during polishing")
             if not output_progress:
                 logger.disabled = logger_state
@@ -105,20 +147,16 @@ def polish(contig_seqs, read_seqs, work_dir, num_iters, num_threads, read_platfo
             open(polished_file, "w")
             return polished_file, stats_file
 
-        #####
-        logger.info("Correcting bubbles")
-        _run_polish_bin(bubbles_file, subs_matrix, hopo_matrix,
-                        consensus_out, num_threads, output_progress, use_hopo)
-        polished_fasta, polished_lengths = _compose_sequence(consensus_out)
+        if region_map:
+            _fill_unpolished_regions(region_consensus, region_map, prev_assembly)
+        polished_fasta, polished_lengths = _stitch_regions(region_consensus, ctg_lengths)
         fp.write_fasta_dict(polished_fasta, polished_file)
 
-        #Cleanup
-        os.remove(bubbles_file)
-        os.remove(consensus_out)
-        if not bam_input:
-            os.remove(alignment_file)
-
         contig_lengths = polished_lengths
+        #regions are weighted by their lengths
+        coverage_stats = {ctg: int(sum(c * l for c, l in cov) /
+                                   max(sum(l for _c, l in cov), 1))
+                          for ctg, cov in iteritems(region_coverage)}
         prev_assembly = polished_file
 
     with open(stats_file, "w") as f:
@@ -269,6 +307,225 @@ def filter_by_coverage(args, stats_in, contigs_in, stats_out, contigs_out):
                     ctg_stats[ctg_id][0], ctg_stats[ctg_id][1]))
 
 
+def _polish_batch(alignment_file, contigs_file, work_dir, suffix, read_platform,
+                  subs_matrix, hopo_matrix, num_threads, output_progress, use_hopo):
+    """
+    Bubbles -> consensus pipeline for a single batch of contigs
+    (or contig regions), given the alignment of this batch.
+    Returns None if no reads were aligned
+    """
+    logger.info("Separating alignment into bubbles")
+    contigs_info = get_contigs_info(contigs_file)
+    bubbles_file = os.path.join(work_dir, "bubbles_{0}.fasta".format(suffix))
+    coverage_stats, mean_aln_error = \
+        make_bubbles(alignment_file, contigs_info, contigs_file,
+                     read_platform, num_threads, bubbles_file)
+
+    if os.path.getsize(bubbles_file) == 0:
+        os.remove(bubbles_file)
+        return None
+
+    logger.info("Correcting bubbles")
+    consensus_out = os.path.join(work_dir, "consensus_{0}.fasta".format(suffix))
+    _run_polish_bin(bubbles_file, subs_matrix, hopo_matrix,
+                    consensus_out, num_threads, output_progress, use_hopo)
+    consensus = _read_consensus(consensus_out)
+
+    os.remove(bubbles_file)
+    os.remove(consensus_out)
+
+    region_lengths = {ctg: info.length for ctg, info in iteritems(contigs_info)}
+    return consensus, coverage_stats, region_lengths, mean_aln_error
+
+
+def _split_into_regions(contig_lengths, region_len, overlap):
+    """
+    Groups contigs into batches with the total length of about region_len.
+    Contigs that are longer than region_len are cut into overlapping regions.
+    Returns the list of batches, each is a list of ContigRegion
+    """
+    if region_len <= 0:
+        return [[ContigRegion(ctg, 0, length) for ctg, length in iteritems(contig_lengths)]]
+    overlap = min(overlap, region_len // 2)
+
+    regions = []
+    for ctg_id, ctg_len in iteritems(contig_lengths):
+        start = 0
+        while True:
+            end = min(start + region_len, ctg_len)
+            regions.append(ContigRegion(ctg_id, start, end))
+            if end == ctg_len:
+                break
+            start = end - overlap
+
+    batches = [[]]
+    batch_len = 0
+    for region in regions:
+        if batches[-1] and batch_len + region.end - region.start > region_len:
+            batches.append([])
+            batch_len = 0
+        batches[-1].append(region)
+        batch_len += region.end - region.start
+
+    return batches
+
+
+def _region_name(region, ctg_len):
+    if region.start == 0 and region.end == ctg_len:
+        return region.ctg_id
+    return "{0}:{1}-{2}".format(region.ctg_id, region.start, region.end)
+
+
+def _write_region_batches(contigs_file, batches, work_dir):
+    """
+    For each batch, writes sequences of its regions into a separate fasta.
+    Also returns the mapping from region names to
+    (contig id, region start, region end)
+    """
+    batch_files = []
+    ctg_regions = defaultdict(list)
+    for batch_id, batch in enumerate(batches):
+        batch_files.append(os.path.join(work_dir, "regions_{0}.fasta".format(batch_id + 1)))
+        open(batch_files[-1], "w").close()
+        for region in batch:
+            ctg_regions[region.ctg_id].append((batch_id, region))
+
+    region_map = {}
+    for ctg_id, ctg_seq in fp.stream_sequence(contigs_file):
+        for batch_id, region in ctg_regions[ctg_id]:
+            region_name = _region_name(region, len(ctg_seq))
+            region_map[region_name] = (ctg_id, region.start, region.end)
+            with open(batch_files[batch_id], "a") as f:
+                f.write(">{0}\n".format(region_name))
+                for pos in range(region.start, region.end, 60):
+                    f.write(ctg_seq[pos : min(pos + 60, region.end)] + "\n")
+
+    return batch_files, region_map
+
+
+def _fill_unpolished_regions(region_consensus, region_map, contigs_file):
+    """
+    Regions without consensus (no reads aligned, or an empty batch)
+    of the otherwise polished contigs are filled with their unpolished
+    sequence. Inside the overlaps with the neighbouring regions, the
+    sequence is split into single-base pseudo-bubbles, so the neighbours
+    could still be joined at their own bubble boundaries
+    """
+    ctg_regions = defaultdict(list)
+    for ctg_id, start, end in region_map.values():
+        ctg_regions[ctg_id].append((start, end))
+
+    missing = defaultdict(list)
+    for ctg_id, polished in iteritems(region_consensus):
+        polished_coords = set((start, end) for start, end, _b in polished)
+        expected = sorted(ctg_regions[ctg_id])
+        for i, (start, end) in enumerate(expected):
+            if (start, end) in polished_coords:
+                continue
+            left_ovlp = expected[i - 1][1] if i > 0 else start
+            right_ovlp = expected[i + 1][0] if i + 1 < len(expected) else end
+            missing[ctg_id].append((start, end, left_ovlp, right_ovlp))
+    if not missing:
+        return
+
+    filled_regions = 0
+    filled_length = 0
+    for ctg_id, ctg_seq in fp.stream_sequence(contigs_file):
+        for start, end, left_ovlp, right_ovlp in missing.get(ctg_id, []):
+            middle_start = max(start, min(left_ovlp, end))
+            middle_end = max(middle_start, min(right_ovlp, end))
+            bubbles = [(pos - start, 0, ctg_seq[pos])
+                       for pos in range(start, middle_start)]
+            if middle_start < middle_end:
+                bubbles.append((middle_start - start, 0,
+                                ctg_seq[middle_start : middle_end]))
+            bubbles.extend((pos - start, 0, ctg_seq[pos])
+                           for pos in range(middle_end, end))
+            region_consensus[ctg_id].append((start, end, bubbles))
+            filled_regions += 1
+            filled_length += end - start
+
+    logger.debug("Filled %d unpolished regions of total length %d",
+                 filled_regions, filled_length)
+
+
+def _stitch_regions(region_consensus, ctg_lengths):
+    """
+    Concatenates polished regions into contigs. Two consecutive regions
+    are joined inside their overlap, at the bubble boundary that is
+    shared by both of them (and is the closest to the overlap center).
+    The regions must cover the whole contig, otherwise an exception is raised
+    """
+    polished_fasta = {}
+    polished_lengths = {}
+    inexact_joins = 0
+    for ctg_id, regions in iteritems(region_consensus):
+        regions = sorted(regions, key=lambda r: r[0])
+        prev_end = 0
+        for start, end, _bubbles in regions:
+            if start > prev_end:
+                raise PolishException("Polished regions of {0} leave a gap at {1}-{2}"
+                                      .format(ctg_id, prev_end, start))
+            prev_end = max(prev_end, end)
+        if prev_end != ctg_lengths[ctg_id]:
+            raise PolishException("Polished regions of {0} leave a gap at {1}-{2}"
+                                  .format(ctg_id, prev_end, ctg_lengths[ctg_id]))
+
+        #bubbles in contig coordinates, sorted
+        regions = [[(pos + start, sub_pos, seq) for pos, sub_pos, seq in sorted(bubbles)]
+                   for start, _end, bubbles in regions]
+
+        ctg_bubbles = []
+        left_cut = None
+        for i, bubbles in enumerate(regions):
+            right_cut = None
+            if i + 1 < len(regions) and bubbles and regions[i + 1]:
+                ovlp_start = regions[i + 1][0][0]
+                ovlp_end = bubbles[-1][0]
+                ovlp_center = (ovlp_start + ovlp_end) // 2
+                common = (set(b[0] for b in bubbles if b[0] >= ovlp_start) &
+                          set(b[0] for b in regions[i + 1] if b[0] <= ovlp_end))
+                if common:
+                    right_cut = min(common, key=lambda p: abs(p - ovlp_center))
+                else:
+                    right_cut = ovlp_center
+                    inexact_joins += 1
+
+            ctg_bubbles.extend(b[2] for b in bubbles
+                               if (left_cut is None or b[0] >= left_cut) and
+                                  (right_cut is None or b[0] < right_cut))
+            left_cut = right_cut
+
+        concat_seq = "".join(ctg_bubbles)
+        polished_fasta[ctg_id] = concat_seq
+        polished_lengths[ctg_id] = len(concat_seq)
+
+    if inexact_joins:
+        logger.debug("Regions joined without a shared bubble boundary: %d", inexact_joins)
+    return polished_fasta, polished_lengths
+
+
+def _run_align_bin(contigs, read_seqs, read_platform, alignment_out, num_threads):
+    """
+    Maps reads to contigs with the in-process minimap2 and buckets
+    the alignments by the same contig windows that are used for bubbles.
+    Buckets are spilled to disk once they exceed polish_align_memory (Mb)
+    """
+    cmdline = [POLISH_BIN, "align", "--contigs", contigs,
+               "--reads", ",".join(read_seqs), "--platform", read_platform,
+               "--out", alignment_out, "--window", str(CHUNK_SIZE),
+               "--memory", str(cfg.vals["polish_align_memory"]),
+               "--threads", str(num_threads)]
+    try:
+        subprocess.check_call(cmdline)
+    except subprocess.CalledProcessError as e:
+        if e.returncode == -9:
+            logger.error("Looks like the system ran out of memory")
+        raise PolishException(str(e))
+    except OSError as e:
+        raise PolishException(str(e))
+
+
 def _run_polish_bin(bubbles_in, subs_matrix, hopo_matrix,
                     consensus_out, num_threads, output_progress, use_hopo):
     """
@@ -293,12 +550,12 @@ def _run_polish_bin(bubbles_in, subs_matrix, hopo_matrix,
         raise PolishException(str(e))
 
 
-def _compose_sequence(consensus_file):
+def _read_consensus(consensus_file):
     """
-    Concatenates bubbles consensuses into genome
+    Reads bubbles consensuses: for each contig, a list of
+    (position, sub-position, sequence) tuples
     """
     consensuses = defaultdict(list)
-    coverage = defaultdict(list)
     with open(consensus_file, "r") as f:
         header = True
         for line in f:
@@ -309,19 +566,9 @@ def _compose_sequence(consensus_file):
 
                 ctg_id = tokens[0][1:]
                 ctg_pos = int(tokens[1])
-                #coverage[ctg_id].append(int(tokens[2]))
                 ctg_sub_pos = int(tokens[3])
             else:
                 consensuses[ctg_id].append((ctg_pos, ctg_sub_pos, line.strip()))
             header = not header
 
-    polished_fasta = {}
-    polished_stats = {}
-    for ctg_id, seqs in iteritems(consensuses):
-        sorted_seqs = [p[2] for p in sorted(seqs, key=lambda p: (p[0], p[1]))]
-        concat_seq = "".join(sorted_seqs)
-        #mean_coverage = sum(coverage[ctg_id]) / len(coverage[ctg_id])
-        polished_fasta[ctg_id] = concat_seq
-        polished_stats[ctg_id] = len(concat_seq)
-
-    return polished_fasta, polished_stats
+    return consensuses
@@ -17,6 +17,7 @@ import subprocess
 import logging
 import multiprocessing
 import ctypes
+import struct
 import time
 import random
 from copy import copy
@@ -187,7 +188,12 @@ class SynchronizedSamReader(object):
         #check that alignment exists
         if not os.path.exists(sam_alignment):
             raise AlignmentException("Can't open {0}".format(sam_alignment))
-        if not os.path.exists(sam_alignment + ".bai"):
+        #alignment is either a sorted and indexed BAM, or the output
+        #of "flye-modules align", bucketed by contig windows
+        self.bucket_index = None
+        if os.path.exists(sam_alignment + ".idx"):
+            self.bucket_index = _read_bucket_index(sam_alignment + ".idx")
+        elif not os.path.exists(sam_alignment + ".bai"):
             raise AlignmentException("Bam not indexed: {0}".format(sam_alignment))
 
         #will not be changed during exceution, each process has its own copy
@@ -334,6 +340,155 @@ class SynchronizedSamReader(object):
 
         return trimmed_aln
 
+    def _read_buckets(self, parsed_contig, region_start, region_end):
+        """
+        Reads the records of the bucketed alignment that overlap the region.
+        Records are returned in the same order as in the position-sorted BAM.
+        """
+        #each record is stored once, in the window where it starts
+        windows = [w for w in self.bucket_index.get(parsed_contig, [])
+                   if w.start < region_end and region_start < w.max_end]
+        records = []
+        with open(self.aln_path, "rb") as f:
+            for window in windows:
+                for offset, length in window.segments:
+                    f.seek(offset)
+                    records.extend(_unpack_records(f.read(length)))
+
+        #records of the windows around the region might not overlap it
+        records = [r for r in records
+                   if r.ref_start < region_end and region_start < r.ref_end]
+        records.sort(key=lambda r: (r.ref_start, r.read_id))
+        return records
+
+    def _get_bucket_median_depth(self, parsed_contig, region_start, region_end):
+        """
+        Same as "samtools depth -a -Q 10 -l 100", but computed from
+        the bucketed alignment. Records keep only the aligned part of the read,
+        so the length filter uses the query length of the original record
+        """
+        MIN_MAPQ = 10
+        MIN_LEN = 100
+
+        coverage = [0] * (region_end - region_start + 1)
+        for rec in self._read_buckets(parsed_contig, region_start, region_end):
+            if rec.flag & 0x100 or rec.map_qv < MIN_MAPQ or rec.orig_qry_len < MIN_LEN:
+                continue
+
+            trg_pos = rec.ref_start
+            for op in rec.cigar:
+                size, code = op >> 4, op & 0xf
+                if code in _CIGAR_ALN:
+                    block_start = max(trg_pos, region_start)
+                    block_end = min(trg_pos + size, region_end)
+                    if block_start < block_end:
+                        coverage[block_start - region_start] += 1
+                        coverage[block_end - region_start] -= 1
+                if code in _CIGAR_REF:
+                    trg_pos += size
+
+        all_cov_pos = []
+        cur_cov = 0
+        for diff in coverage[:-1]:
+            cur_cov += diff
+            all_cov_pos.append(cur_cov)
+
+        return get_median(all_cov_pos) if all_cov_pos else 0
+
+    def _bucket_alignment(self, rec, parsed_contig, contig_str):
+        """
+        Converts a binary bucket record into Alignment.
+        Returns None for the records that should be skipped
+        """
+        is_secondary = rec.flag & 0x100
+        if is_secondary and not self.use_secondary:
+            return None
+
+        trg_seq = []
+        qry_seq = []
+        trg_pos = rec.ref_start
+        qry_pos = 0
+        for op in rec.cigar:
+            size, code = op >> 4, op & 0xf
+            if code in _CIGAR_ALN:
+                qry_seq.append(rec.seq[qry_pos : qry_pos + size])
+                trg_seq.append(contig_str[trg_pos : trg_pos + size].upper())
+                qry_pos += size
+                trg_pos += size
+            elif code == _CIGAR_INS:
+                qry_seq.append(rec.seq[qry_pos : qry_pos + size])
+                trg_seq.append(b"-" * size)
+                qry_pos += size
+            elif code == _CIGAR_DEL:
+                qry_seq.append(b"-" * size)
+                trg_seq.append(contig_str[trg_pos : trg_pos + size].upper())
+                trg_pos += size
+            else:
+                raise AlignmentException("Unsupported CIGAR operation: " + str(code))
+
+        trg_seq = b"".join(trg_seq)
+        qry_seq = b"".join(qry_seq)
+        matches = 0
+        for i in range(len(trg_seq)):
+            if trg_seq[i] == qry_seq[i]:
+                matches += 1
+        err_rate = 1 - matches / len(trg_seq)
+
+        qry_start = rec.clip_left
+        qry_end = qry_start + len(rec.seq)
+        return Alignment(_STR(rec.read_id), _STR(parsed_contig),
+                         qry_start, qry_end, "-" if rec.flag & 0x10 else "+",
+                         qry_end + rec.clip_right,
+                         rec.ref_start, trg_pos, "+", len(contig_str),
+                         _STR(qry_seq), _STR(trg_seq), err_rate,
+                         is_secondary, rec.flag & 0x800, rec.map_qv)
+
+    def _sam_alignment(self, line, parsed_contig, contig_str):
+        """
+        Converts a SAM line into Alignment.
+        Returns None for the records that should be skipped
+        """
+        tokens = line.strip().split()
+        if len(tokens) < 11:
+            #raise AlignmentException("Error reading SAM file")
+            return None
+
+        flags = int(tokens[1])
+        is_unmapped = flags & 0x4
+        is_secondary = flags & 0x100
+        is_supplementary = flags & 0x800
+        is_reversed = flags & 0x16
+
+        if is_unmapped: return None
+        if is_secondary and not self.use_secondary: return None
+
+        read_id = tokens[0]
+        cigar_str = tokens[5]
+        read_str = tokens[9]
+        map_qv = int(tokens[4])
+        ctg_pos = int(tokens[3])
+
+        if read_str == b"*":
+            return None
+            #raise Exception("Error parsing SAM: record without read sequence")
+
+        if parsed_contig is None:
+            parsed_contig = tokens[2]
+            contig_str = self.ref_fasta[parsed_contig]
+
+        (trg_start, trg_end, trg_len, trg_seq,
+        qry_start, qry_end, qry_len, qry_seq, err_rate) = \
+                self._parse_cigar(cigar_str, read_str, contig_str, ctg_pos)
+
+        #OVERHANG = cfg.vals["read_aln_overhang"]
+        #if (float(qry_end - qry_start) / qry_len > self.min_aln_rate or
+        #        trg_start < OVERHANG or trg_len - trg_end < OVERHANG):
+        return Alignment(_STR(read_id), _STR(parsed_contig),
+                         qry_start, qry_end, "-" if is_reversed else "+", qry_len,
+                         trg_start, trg_end, "+", trg_len,
+                         _STR(qry_seq), _STR(trg_seq), err_rate,
+                         is_secondary, is_supplementary, map_qv)
+
     def get_median_depth(self, region_id, region_start=None, region_end=None):
         parsed_contig = _BYTES(region_id)
         contig_str = self.ref_fasta[parsed_contig]
@@ -342,6 +497,9 @@ class SynchronizedSamReader(object):
         if region_end is None:
             region_end = len(contig_str)
 
+        if self.bucket_index is not None:
+            return self._get_bucket_median_depth(parsed_contig, region_start, region_end)
+
         samtools_out = subprocess.Popen("{0} depth {1} -r '{2}:{3}-{4}' -a -m 0 -Q 10 -l 100"
                                         .format(SAMTOOLS_BIN, self.aln_path,
                                                 _STR(parsed_contig), region_start, region_end),
@@ -362,14 +520,19 @@ class SynchronizedSamReader(object):
             region_end = len(contig_str)
         #logger.debug("Reading region: {0} {1} {2}".format(region_id, region_start, region_end))
 
-        aln_file = subprocess.Popen("{0} view {1} '{2}:{3}-{4}'"
-                                        .format(SAMTOOLS_BIN, self.aln_path,
-                                                _STR(parsed_contig), region_start, region_end),
-                                    shell=True, stdout=subprocess.PIPE).stdout
+        if self.bucket_index is not None:
+            chunk_buffer = self._read_buckets(parsed_contig, region_start, region_end)
+            parse_record = self._bucket_alignment
+        else:
+            aln_file = subprocess.Popen("{0} view {1} '{2}:{3}-{4}'"
+                                            .format(SAMTOOLS_BIN, self.aln_path,
+                                                    _STR(parsed_contig), region_start, region_end),
+                                        shell=True, stdout=subprocess.PIPE).stdout
 
-        chunk_buffer = []
-        for line in aln_file:
-            chunk_buffer.append(line)
+            chunk_buffer = []
+            for line in aln_file:
+                chunk_buffer.append(line)
+            parse_record = self._sam_alignment
 
         #shuffle alignments so that they uniformly distributed. Needed for
         #max_coverage subsampling. Using the same seed for determinism
@@ -379,46 +542,13 @@ class SynchronizedSamReader(object):
 
         sequence_length = 0
         alignments = []
-        for line in chunk_buffer:
-            tokens = line.strip().split()
-            if len(tokens) < 11:
-                #raise AlignmentException("Error reading SAM file")
+        for record in chunk_buffer:
+            aln = parse_record(record, parsed_contig, contig_str)
+            if aln is None:
                 continue
-
-            flags = int(tokens[1])
-            is_unmapped = flags & 0x4
-            is_secondary = flags & 0x100
-            is_supplementary = flags & 0x800
-            is_reversed = flags & 0x16
-
-            if is_unmapped: continue
-            if is_secondary and not self.use_secondary: continue
-
-            read_id = tokens[0]
-            cigar_str = tokens[5]
-            read_str = tokens[9]
-            map_qv = int(tokens[4])
-            ctg_pos = int(tokens[3])
-
-            if read_str == b"*":
-                continue
-                #raise Exception("Error parsing SAM: record without read sequence")
-
-            (trg_start, trg_end, trg_len, trg_seq,
-            qry_start, qry_end, qry_len, qry_seq, err_rate) = \
-                    self._parse_cigar(cigar_str, read_str, contig_str, ctg_pos)
-
-            #OVERHANG = cfg.vals["read_aln_overhang"]
-            #if (float(qry_end - qry_start) / qry_len > self.min_aln_rate or
-            #        trg_start < OVERHANG or trg_len - trg_end < OVERHANG):
-            aln = Alignment(_STR(read_id), _STR(parsed_contig),
-                            qry_start, qry_end, "-" if is_reversed else "+", qry_len,
-                            trg_start, trg_end, "+", trg_len,
-                            _STR(qry_seq), _STR(trg_seq), err_rate,
-                            is_secondary, is_supplementary, map_qv)
             alignments.append(aln)
 
-            sequence_length += qry_end - qry_start
+            sequence_length += aln.qry_end - aln.qry_start
             if sequence_length // len(contig_str) > self.max_coverage:
                 break
 
@@ -428,50 +558,78 @@ class SynchronizedSamReader(object):
         return alignments
 
     def get_all_alignments(self):
-        aln_file = subprocess.Popen("{0} view {1}".format(SAMTOOLS_BIN, self.aln_path),
-                                    shell=True, stdout=subprocess.PIPE).stdout
-
         alignments = []
-        for line in aln_file:
-            tokens = line.strip().split()
-            if len(tokens) < 11:
-                #raise AlignmentException("Error reading SAM file")
-                continue
-
-            flags = int(tokens[1])
-            is_unmapped = flags & 0x4
-            is_secondary = flags & 0x100
-            is_supplementary = flags & 0x800
-            is_reversed = flags & 0x16
-
-            if is_unmapped: continue
-            if is_secondary and not self.use_secondary: continue
+        if self.bucket_index is not None:
+            for ctg_id in self.bucket_index:
+                contig_str = self.ref_fasta[ctg_id]
+                for rec in self._read_buckets(ctg_id, 0, len(contig_str)):
+                    aln = self._bucket_alignment(rec, ctg_id, contig_str)
+                    if aln is not None:
+                        alignments.append(aln)
+        else:
+            aln_file = subprocess.Popen("{0} view {1}".format(SAMTOOLS_BIN, self.aln_path),
+                                        shell=True, stdout=subprocess.PIPE).stdout
+            for line in aln_file:
+                aln = self._sam_alignment(line, None, None)
+                if aln is not None:
+                    alignments.append(aln)
 
-            read_id = tokens[0]
-            parsed_contig = tokens[2]
-            cigar_str = tokens[5]
-            read_str = tokens[9]
-            map_qv = int(tokens[4])
-            ctg_pos = int(tokens[3])
+        return alignments
 
-            if read_str == b"*":
-                continue
-                #raise Exception("Error parsing SAM: record without read sequence")
 
-            contig_str = self.ref_fasta[parsed_contig]
+BucketWindow = namedtuple("BucketWindow", ["start", "end", "max_end", "segments"])
+BucketRecord = namedtuple("BucketRecord", ["ref_start", "ref_end", "clip_left",
+                                           "clip_right", "orig_qry_len", "flag",
+                                           "map_qv", "read_id", "cigar", "seq"])
 
-            (trg_start, trg_end, trg_len, trg_seq,
-            qry_start, qry_end, qry_len, qry_seq, err_rate) = \
-                    self._parse_cigar(cigar_str, read_str, contig_str, ctg_pos)
+#fixed part of a binary record of "flye-modules align", see minimap_aligner.h
+_RECORD_HEADER = struct.Struct("<IiiiiiHBxIII")
+#minimap2 CIGAR operation codes
+_CIGAR_INS = 1
+_CIGAR_DEL = 2
+_CIGAR_ALN = (0, 7, 8)          #M, =, X
+_CIGAR_REF = (0, 2, 3, 7, 8)    #M, D, N, =, X
 
-            aln = Alignment(_STR(read_id), _STR(parsed_contig),
-                            qry_start, qry_end, "-" if is_reversed else "+", qry_len,
-                            trg_start, trg_end, "+", trg_len,
-                            _STR(qry_seq), _STR(trg_seq), err_rate,
-                            is_secondary, is_supplementary, map_qv)
-            alignments.append(aln)
 
-        return alignments
+def _unpack_records(buffer):
+    """
+    Unpacks binary alignment records from a segment of the bucketed alignment
+    """
+    records = []
+    pos = 0
+    while pos < len(buffer):
+        (_ctg_id, ref_start, ref_end, clip_left, clip_right, orig_qry_len,
+         flag, map_qv, name_len, num_cigar, seq_len) = \
+                _RECORD_HEADER.unpack_from(buffer, pos)
+        pos += _RECORD_HEADER.size
+        read_id = buffer[pos : pos + name_len]
+        pos += name_len
+        cigar = struct.unpack_from("<{0}I".format(num_cigar), buffer, pos)
+        pos += 4 * num_cigar
+        seq = buffer[pos : pos + seq_len]
+        pos += seq_len
+        records.append(BucketRecord(ref_start, ref_end, clip_left, clip_right,
+                                    orig_qry_len, flag, map_qv, read_id, cigar, seq))
+    return records
+
+
+def _read_bucket_index(index_path):
+    """
+    Reads the index of the bucketed alignment: for each contig window,
+    the rightmost end of its records and the list of (offset, length)
+    segments of the alignment file
+    """
+    index = defaultdict(list)
+    with open(index_path, "rb") as f:
+        for line in f:
+            ctg_id, start, end, offset, length, max_end = line.split()
+            start, end = int(start), int(end)
+            windows = index[ctg_id]
+            if not windows or windows[-1].start != start:
+                windows.append(BucketWindow(start, end, int(max_end), []))
+            windows[-1].segments.append((int(offset), int(length)))
+
+    return dict(index)
 
 
 #def _is_sam_header(line):
@@ -0,0 +1,2 @@
+HTSLIB_static_LDFLAGS = -lz -L/root/repo/lib/minimap2 -lminimap2 -rdynamic
+HTSLIB_static_LIBS = -lpthread -lz -lm
@@ -14,13 +14,44 @@
 #include "chimera.h"
 
 
+namespace
+{
+	//Coverage profiles are computed with a difference array: each overlap
+	//only updates the first and past-the-last windows it covers, and the
+	//coverage is then restored by the prefix sums. This takes
+	//O(overlaps + windows) instead of O(overlaps * windows).
+	//As before, the first and last windows of each overlap are skipped
+	//to be more robust to possible coordinate shifts.
+	const int COV_FLANK = 1;
+
+	void addOverlapWindows(std::vector<int32_t>& diff, 
+						   const OverlapRange& ovlp, int window)
+	{
+		//diff has one extra element for the past-the-last updates
+		int first = ovlp.curBegin / window;
+		int last = std::min(ovlp.curEnd / window - 2 * COV_FLANK,
+							(int)diff.size() - 2);
+		if (first > last) return;
+		++diff[first];
+		--diff[last + 1];
+	}
+
+	void restoreCoverage(std::vector<int32_t>& diff)
+	{
+		for (size_t i = 1; i < diff.size(); ++i) diff[i] += diff[i - 1];
+		diff.pop_back();
+	}
+
+	//scratch buffer for the coverage profiles that are not stored
+	thread_local std::vector<int32_t> coverageBuffer;
+}
 
 /*bool ChimeraDetector::isChimeric(FastaRecord::Id readId)
 {
 	if (!_chimeras.contains(readId))
 	{
-		const auto& ovlps = _ovlpContainer.lazySeqOverlaps(readId);
-		bool result = this->testReadByCoverage(readId, ovlps);
+		auto ovlps = _ovlpContainer.lazySeqOverlaps(readId);
+		bool result = this->testReadByCoverage(readId, *ovlps);
 					  //_ovlpContainer.hasSelfOverlaps(readId);
 		_chimeras.insert(readId, result);
 		_chimeras.insert(readId.rc(), result);
@@ -74,7 +105,7 @@ void ChimeraDetector::estimateGlobalCoverage()
 	for (const auto& seq : _seqContainer.iterSeqs())
 	{
 		if (rand() % sampleRate) continue;
-		auto coverage = this->getReadCoverage(seq.id, _ovlpContainer.lazySeqOverlaps(seq.id));
+		const auto& coverage = this->getReadCoverage(seq.id, *_ovlpContainer.lazySeqOverlaps(seq.id));
 		bool nonZero = false;
 		for (auto c : coverage) nonZero |= (c != 0);
 		if (!nonZero) continue;
@@ -103,32 +134,31 @@ void ChimeraDetector::estimateGlobalCoverage()
 	Logger::get().info() << "Overlap-based coverage: " << _overlapCoverage;
 }
 
-std::vector<int32_t> 
+//Returns the reference to a thread-local buffer, which is
+//only valid until the next call from the same thread
+const std::vector<int32_t>& 
 	ChimeraDetector::getReadCoverage(FastaRecord::Id readId,
 									 const std::vector<OverlapRange>& readOverlaps)
 {
 	static const int WINDOW = Config::get("chimera_window");
-	const int FLANK = 1;
 
-	std::vector<int> coverage;
+	std::vector<int32_t>& coverage = coverageBuffer;
 	int numWindows = std::ceil((float)_seqContainer.seqLen(readId) / WINDOW) + 1;
-	if (numWindows - 2 * FLANK <= 0) return {0};
+	if (numWindows - 2 * COV_FLANK <= 0) 
+	{
+		coverage.assign(1, 0);
+		return coverage;
+	}
 
-	coverage.assign(numWindows - 2 * FLANK, 0);
+	coverage.assign(numWindows - 2 * COV_FLANK + 1, 0);
 	for (const auto& ovlp : IterNoOverhang(readOverlaps))
 	{
 		if (ovlp.curId == ovlp.extId.rc() ||
 			ovlp.curId == ovlp.extId) continue;
 
-		//skip 2 first/last windows of overlap to be more robust to
-		//possible coorinate shifts
-		for (int pos = ovlp.curBegin / WINDOW + FLANK; 		
-			 pos <= ovlp.curEnd / WINDOW - FLANK; ++pos)
-		{
-			//assert(pos - FLANK >= 0 && pos - FLANK < (int)coverage.size());
-			++coverage.at(pos - FLANK);
-		}
+		addOverlapWindows(coverage, ovlp, WINDOW);
 	}
+	restoreCoverage(coverage);
 
 	return coverage;
 }
@@ -137,7 +167,7 @@ std::vector<int32_t>
 float ChimeraDetector::maxCoverageDrop(FastaRecord::Id readId,
 									   const std::vector<OverlapRange>& readOvlps)
 {
-	auto coverage = this->getReadCoverage(readId, readOvlps);
+	const auto& coverage = this->getReadCoverage(readId, readOvlps);
 	if (coverage.empty()) return 0;
 
 	const int CHIMERA_OVERHANG = (int)Config::get("chimera_overhang");
@@ -161,7 +191,7 @@ bool ChimeraDetector::testReadByCoverage(FastaRecord::Id readId,
 {
 	const float MAX_DROP_RATE = Config::get("max_coverage_drop_rate");
 
-	auto coverage = this->getReadCoverage(readId, readOvlps);
+	const auto& coverage = this->getReadCoverage(readId, readOvlps);
 	if (coverage.empty()) return false;
 
 	const int CHIMERA_OVERHANG = (int)Config::get("chimera_overhang");
@@ -313,34 +343,24 @@ ChimeraDetector::CachedCoverage
 	//not cached - need to copmute
 	const int WINDOW = Config::get("chimera_window");
 	const int MAX_OVERHANG = Config::get("maximum_overhang");
-	const int FLANK = 1;
 
 	int numWindows = std::ceil((float)_seqContainer.seqLen(readId) / WINDOW) + 1;
-	int vecSize = numWindows - 2 * FLANK;
+	int vecSize = numWindows - 2 * COV_FLANK;
 	if (vecSize <= 0) throw std::runtime_error("Zero-sized coverage vector");
 
-	std::vector<int> coverage(vecSize, 0);
-	std::vector<int> junctions(vecSize, 0);
+	std::vector<int32_t> coverage(vecSize + 1, 0);
+	std::vector<int32_t> junctions(vecSize + 1, 0);
 	auto overlaps = _ovlpContainer.quickSeqOverlaps(readId, /*max ovlps*/ 0, /*force local*/ true);
 	for (const auto& ovlp : overlaps)
 	{
 		if (ovlp.curId == ovlp.extId.rc() ||
 			ovlp.curId == ovlp.extId) continue;
 
-		for (int pos = ovlp.curBegin / WINDOW + FLANK; 
-			 pos <= ovlp.curEnd / WINDOW - FLANK; ++pos)
-		{
-			if (ovlp.lrOverhang() > MAX_OVERHANG)
-			{
-				++junctions.at(pos - FLANK);
-			}
-			else
-			{
-				++coverage.at(pos - FLANK);
-			}
-		}
+		addOverlapWindows(ovlp.lrOverhang() > MAX_OVERHANG ? junctions : coverage,
+						  ovlp, WINDOW);
 	}
-	//
+	restoreCoverage(coverage);
+	restoreCoverage(junctions);
 
 	//updating cache
 	_localOvlpsStorage.update_fn(readId,
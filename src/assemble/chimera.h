@@ -26,12 +26,13 @@ public:
 						  const std::vector<OverlapRange>& readOvlps);
 
 	int  getOverlapCoverage() const {return _overlapCoverage;}
+	void setOverlapCoverage(int coverage) {_overlapCoverage = coverage;}
 	int  getRightTrim(FastaRecord::Id readId);
 	bool isRepetitiveRegion(FastaRecord::Id readId, int32_t start, int32_t end, bool debug=false);
 
 private:
-	std::vector<int32_t> getReadCoverage(FastaRecord::Id readId,
-										 const std::vector<OverlapRange>& readOvlps);
+	const std::vector<int32_t>& getReadCoverage(FastaRecord::Id readId,
+												const std::vector<OverlapRange>& readOvlps);
 
 	bool testReadByCoverage(FastaRecord::Id readId,
 							const std::vector<OverlapRange>& readOvlps);
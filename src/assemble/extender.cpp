@@ -7,6 +7,9 @@
 #include <iomanip>
 #include <stack>
 #include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <atomic>
 
 #include "../common/config.h"
 #include "../common/logger.h"
@@ -65,7 +68,7 @@ Extender::ExtensionInfo Extender::extendDisjointig(FastaRecord::Id startRead)
 	auto startOverlaps = _ovlpContainer.lazySeqOverlaps(startRead);
 	auto leftExtendsStart = [startRead, this, &startOverlaps](const FastaRecord::Id readId)
 	{
-		for (const auto& ovlp : IterNoOverhang(startOverlaps))
+		for (const auto& ovlp : IterNoOverhang(*startOverlaps))
 		{
 			if (ovlp.extId == readId && this->extendsLeft(ovlp)) return true;
 		}
@@ -74,9 +77,9 @@ Extender::ExtensionInfo Extender::extendDisjointig(FastaRecord::Id startRead)
 
 	while(true)
 	{
-		const std::vector<OverlapRange>& curOverlaps = _ovlpContainer.lazySeqOverlaps(currentRead);
+		auto curOverlaps = _ovlpContainer.lazySeqOverlaps(currentRead);
 		std::vector<OverlapRange> extensions;
-		for (const auto& ovlp : IterNoOverhang(curOverlaps))
+		for (const auto& ovlp : IterNoOverhang(*curOverlaps))
 		{
 			if (this->extendsRight(ovlp)) extensions.push_back(ovlp);
 		}
@@ -128,7 +131,8 @@ Extender::ExtensionInfo Extender::extendDisjointig(FastaRecord::Id startRead)
 				if (curRepeat && extRepeat) continue;
 			}
 
-			const std::vector<OverlapRange>& extOverlaps = _ovlpContainer.lazySeqOverlaps(ovlp.extId);
+			auto extOverlapsHandle = _ovlpContainer.lazySeqOverlaps(ovlp.extId);
+			const std::vector<OverlapRange>& extOverlaps = *extOverlapsHandle;
 
 			const float MAX_COVERAGE_DROP = 5.0f;
 			if (_chimDetector.isChimeric(ovlp.extId, extOverlaps) &&
@@ -250,10 +254,22 @@ Extender::ExtensionInfo Extender::extendDisjointig(FastaRecord::Id startRead)
 void Extender::assembleDisjointigs()
 {
 	Logger::get().info() << "Extending reads";
-	_chimDetector.estimateGlobalCoverage();
+	if (!_resumed)
+	{
+		_chimDetector.estimateGlobalCoverage();
+		_innerReads.clear();
+		_readLists.clear();
+	}
+	else
+	{
+		Logger::get().info() << "Overlap-based coverage: " 
+			<< _chimDetector.getOverlapCoverage();
+	}
 	_ovlpContainer.overlapDivergenceStats();
-	_innerReads.clear();
 	cuckoohash_map<FastaRecord::Id, size_t> coveredReads;
+	for (const auto& readId : _resumeCovered) coveredReads.insert(readId, true);
+	_resumeCovered.clear();
+	_lastCheckpoint = std::chrono::steady_clock::now();
 	
 	std::vector<FastaRecord::Id> allReads;
 	for (const auto& seq : _readsContainer.iterSeqs())
@@ -266,12 +282,21 @@ void Extender::assembleDisjointigs()
 	}
 	int totalReads = allReads.size() * 2;	//counting both strands
 	
+	//reads are identified by their position in the processing order,
+	//so that the checkpoints could record the finished prefix of it
+	std::vector<std::atomic<bool>> readDone(allReads.size());
+	const size_t resumeFrom = std::min(_resumeProcessed, allReads.size());
+	for (size_t i = 0; i < allReads.size(); ++i) readDone[i] = i < resumeFrom;
+	size_t numProcessed = resumeFrom;
+
 	std::mutex indexMutex;
 	ProgressPercent progress(totalReads);
-	progress.setValue(0);
-	auto processRead = [this, &indexMutex, &coveredReads, totalReads, &progress] 
-		(FastaRecord::Id startRead)
+	progress.setValue(coveredReads.size());
+	auto processRead = [this, &indexMutex, &coveredReads, totalReads, &progress,
+						&allReads, &readDone, &numProcessed] (size_t readIdx)
 	{
+		FastaRecord::Id startRead = allReads[readIdx];
+
 		//most of the reads will fall into the inner categoty -
 		//so no further processing will be needed
 		if (_innerReads.contains(startRead)) return;
@@ -306,9 +331,6 @@ void Extender::assembleDisjointigs()
 		//Good to go!
 		ExtensionInfo exInfo = this->extendDisjointig(startRead);
 
-		//Exclusive part - updating the overall assembly
-		std::lock_guard<std::mutex> guard(indexMutex);
-
 		/*if (exInfo.reads.size() - exInfo.numSuspicious < 
 			(size_t)Config::get("min_reads_in_disjointig"))
 		{
@@ -316,23 +338,57 @@ void Extender::assembleDisjointigs()
 			//	<< " " << exInfo.leftTip << " " << exInfo.rightTip;
 			return;
 		}*/
-		
-		int innerCount = 0;
-		//do not count first and last reads - they are inner by defalut
-		for (size_t i = 1; i < exInfo.reads.size() - 1; ++i)
-		{
-			if (_innerReads.contains(exInfo.reads[i])) ++innerCount;
-		}
+
+		//disjointigs that mostly consist of the reads that were already 
+		//assembled are discarded. Inner reads are only added, so if
+		//the check fails here, it will also fail in the exclusive part
 		int innerThreshold = std::min((int)Config::get("max_inner_reads"),
 									  int((float)Config::get("max_inner_fraction") * 
 										  exInfo.reads.size()));
-		if (innerCount > innerThreshold)
+		auto tooManyInner = [this, &exInfo, innerThreshold](int& innerCount)
 		{
-			Logger::get().debug() << "Discarded disjointig with "
-				<< exInfo.reads.size() << " reads and "
-				<< innerCount << " inner overlaps";
-			return;
+			innerCount = 0;
+			//do not count first and last reads - they are inner by defalut
+			for (size_t i = 1; i < exInfo.reads.size() - 1; ++i)
+			{
+				if (_innerReads.contains(exInfo.reads[i])) ++innerCount;
+			}
+			if (innerCount > innerThreshold)
+			{
+				Logger::get().debug() << "Discarded disjointig with "
+					<< exInfo.reads.size() << " reads and "
+					<< innerCount << " inner overlaps";
+				return true;
+			}
+			return false;
+		};
+		int innerCount = 0;
+		if (tooManyInner(innerCount)) return;
+
+		//Overlaps of the disjointig reads do not depend on the assembly
+		//state, so they are computed (and cached) before taking the lock.
+		//Only the index updates are done in the exclusive part
+		std::vector<OverlapRange> allOverlaps;
+		std::vector<FastaRecord::Id> coveredExtReads;
+		for (const auto& readId : exInfo.reads)
+		{
+			auto readOverlaps = _ovlpContainer.lazySeqOverlaps(readId);
+			for (const auto& ovlp : IterNoOverhang(*readOverlaps))
+			{
+				allOverlaps.push_back(ovlp);
+				if (ovlp.minRange() > _safeOverlap)
+				{
+					coveredExtReads.push_back(ovlp.extId);
+				}
+			}
 		}
+		auto innerReads = this->getInnerReads(allOverlaps);
+
+		//Exclusive part - updating the overall assembly
+		std::unique_lock<std::mutex> guard(indexMutex);
+
+		//other threads might have assembled some of the reads meanwhile
+		if (tooManyInner(innerCount)) return;
 
 		Logger::get().debug() << "Assembled disjointig " 
 			<< std::to_string(_readLists.size() + 1)
@@ -352,26 +408,18 @@ void Extender::assembleDisjointigs()
 		//Logger::get().debug() << "Ovlp index size: " << _ovlpContainer.indexSize();
 		
 		//update inner read index
-		std::vector<OverlapRange> allOverlaps;
 		for (const auto& readId : exInfo.reads)
 		{
 			coveredReads.insert(readId, true);
 			coveredReads.insert(readId.rc(), true);
 			_innerReads.insert(readId, true);
 			_innerReads.insert(readId.rc(), true);
-
-			for (const auto& ovlp : IterNoOverhang(_ovlpContainer.lazySeqOverlaps(readId)))
-			{
-				allOverlaps.push_back(ovlp);
-				if (ovlp.minRange() > _safeOverlap)
-				{
-					coveredReads.insert(ovlp.extId, true);
-					coveredReads.insert(ovlp.extId.rc(), true);
-				}
-			}
 		}
-
-		auto innerReads = this->getInnerReads(allOverlaps);
+		for (const auto& extId : coveredExtReads)
+		{
+			coveredReads.insert(extId, true);
+			coveredReads.insert(extId.rc(), true);
+		}
 		for (const auto& read : innerReads)
 		{
 			_innerReads.insert(read, true);
@@ -384,22 +432,56 @@ void Extender::assembleDisjointigs()
 		progress.setValue(coveredReads.size());
 		
 		_readLists.push_back(std::move(exInfo));
+
+		readDone[readIdx] = true;
+		while (numProcessed < readDone.size() && readDone[numProcessed]) 
+		{
+			++numProcessed;
+		}
+
+		//only the snapshot is taken under the lock. If the previous
+		//checkpoint is still being written, this one is skipped
+		if (_checkpointMinutes > 0 &&
+			std::chrono::steady_clock::now() - _lastCheckpoint >= 
+				std::chrono::duration<float, std::ratio<60>>(_checkpointMinutes))
+		{
+			std::unique_lock<std::mutex> writeLock(_checkpointMutex, 
+												   std::try_to_lock);
+			if (!writeLock.owns_lock()) return;
+			_lastCheckpoint = std::chrono::steady_clock::now();
+			auto state = this->makeCheckpoint(coveredReads, numProcessed);
+			guard.unlock();
+			this->writeCheckpoint(state);
+		}
 	};
 
-	std::function<void(const FastaRecord::Id&)> threadWorker = 
-		[processRead] (const FastaRecord::Id& readId)
+	std::function<void(const size_t&)> threadWorker = 
+		[processRead, &readDone] (const size_t& readIdx)
 	{
-		processRead(readId);
+		processRead(readIdx);
+		readDone[readIdx] = true;
 	};
 
 	//deterministic shuffling
 	std::sort(allReads.begin(), allReads.end(), 
 			  [](const FastaRecord::Id& id1, const FastaRecord::Id& id2)
 			  {return id1.hash() < id2.hash();});
-	processInParallel(allReads, threadWorker,
+	std::vector<size_t> readsToProcess;
+	for (size_t i = resumeFrom; i < allReads.size(); ++i)
+	{
+		readsToProcess.push_back(i);
+	}
+	processInParallel(readsToProcess, threadWorker,
 					  Parameters::get().numThreads, /*progress*/ false);
 	progress.setDone();
 
+	//the final state, so the extension is skipped after a restart
+	if (_checkpointMinutes > 0) 
+	{
+		std::lock_guard<std::mutex> writeLock(_checkpointMutex);
+		this->writeCheckpoint(this->makeCheckpoint(coveredReads, allReads.size()));
+	}
+
 	/*bool addSingletons = (bool)Config::get("add_unassembled_reads");
 	if (addSingletons)
 	{
@@ -423,7 +505,8 @@ void Extender::assembleDisjointigs()
 		{
 			if (!coveredLocal.count(readId))
 			{
-				for (const auto& ovlp : IterNoOverhang(_ovlpContainer.lazySeqOverlaps(readId)))
+				auto readOverlaps = _ovlpContainer.lazySeqOverlaps(readId);
+				for (const auto& ovlp : IterNoOverhang(*readOverlaps))
 				{
 					if (ovlp.leftShift() >= 0 && ovlp.rightShift() <= 0)
 					{
@@ -579,3 +662,173 @@ bool Extender::extendsLeft(const OverlapRange& ovlp) const
 	static const int MAX_JUMP = Config::get("maximum_jump");
 	return ovlp.leftShift() < -MAX_JUMP;
 }
+
+void Extender::setCheckpoint(const std::string& filename, float intervalMinutes)
+{
+	_checkpointPath = filename;
+	_checkpointMinutes = intervalMinutes;
+}
+
+std::vector<size_t> Extender::checkpointSignature() const
+{
+	//the checkpoint is only valid for the same reads and parameters
+	size_t totalLength = 0;
+	for (const auto& seq : _readsContainer.iterSeqs())
+	{
+		totalLength += seq.sequence.length();
+	}
+	return {_readsContainer.iterSeqs().size(), totalLength,
+			(size_t)Parameters::get().kmerSize, (size_t)_safeOverlap};
+}
+
+Extender::CheckpointState 
+	Extender::makeCheckpoint(cuckoohash_map<FastaRecord::Id, size_t>& coveredReads,
+							 size_t numProcessed)
+{
+	CheckpointState state;
+	state.numProcessed = numProcessed;
+	state.meanDivergence = _ovlpContainer.getMeanDivergence();
+	state.overlapCoverage = _chimDetector.getOverlapCoverage();
+
+	auto copyReads = [](cuckoohash_map<FastaRecord::Id, size_t>& reads,
+						std::vector<FastaRecord::Id>& out)
+	{
+		auto lockedReads = reads.lock_table();
+		out.reserve(lockedReads.size());
+		for (const auto& read : lockedReads) out.push_back(read.first);
+	};
+	copyReads(_innerReads, state.innerReads);
+	copyReads(coveredReads, state.coveredReads);
+	state.readLists = _readLists;
+	return state;
+}
+
+void Extender::writeCheckpoint(const CheckpointState& state)
+{
+	//the previous checkpoint is replaced only after the new one 
+	//is completely written
+	std::string tempPath = _checkpointPath + ".tmp";
+	std::ofstream fout(tempPath);
+	if (!fout)
+	{
+		Logger::get().warning() << "Can't open " << tempPath;
+		return;
+	}
+
+	fout << "Signature";
+	for (size_t value : this->checkpointSignature()) fout << " " << value;
+	fout << "\nParameters " 
+		<< std::setprecision(std::numeric_limits<float>::max_digits10)
+		<< state.meanDivergence << " " << state.overlapCoverage << "\n";
+	fout << "Processed " << state.numProcessed << "\n";
+
+	auto writeReads = [&fout](const std::string& name, 
+							  const std::vector<FastaRecord::Id>& reads)
+	{
+		fout << name << " " << reads.size();
+		for (const auto& read : reads) fout << " " << read;
+		fout << "\n";
+	};
+	writeReads("InnerReads", state.innerReads);
+	writeReads("CoveredReads", state.coveredReads);
+
+	for (const auto& exInfo : state.readLists)
+	{
+		fout << "Disjointig " << exInfo.leftTip << " " << exInfo.rightTip << " " 
+			<< exInfo.numSuspicious << " " << exInfo.meanOverlaps << " " 
+			<< exInfo.stepsToTurn << " " << exInfo.assembledLength << " "
+			<< exInfo.singleton << " " << exInfo.avgOverlapSize << " "
+			<< exInfo.minOverlapSize << " " << exInfo.shortExtensions << " "
+			<< exInfo.reads.size();
+		for (const auto& readId : exInfo.reads) fout << " " << readId;
+		fout << "\n";
+	}
+	fout << "End\n";
+	fout.close();
+
+	if (!fout || std::rename(tempPath.c_str(), _checkpointPath.c_str()) != 0)
+	{
+		Logger::get().warning() << "Error writing checkpoint " << _checkpointPath;
+		return;
+	}
+	Logger::get().debug() << "Checkpoint: " << state.readLists.size() 
+		<< " disjointigs, " << state.numProcessed << " reads processed";
+}
+
+bool Extender::loadCheckpoint()
+{
+	std::ifstream fin(_checkpointPath);
+	if (!fin) return false;
+
+	const std::runtime_error parseError("Error parsing: " + _checkpointPath);
+	std::string buffer;
+	fin >> buffer;
+	if (buffer != "Signature") throw parseError;
+	for (size_t expected : this->checkpointSignature())
+	{
+		size_t value = 0;
+		fin >> value;
+		if (!fin) throw parseError;
+		if (value != expected)
+		{
+			Logger::get().warning() << "Checkpoint " << _checkpointPath 
+				<< " does not match the input, starting from scratch";
+			return false;
+		}
+	}
+
+	float meanDivergence = 0;
+	int overlapCoverage = 0;
+	size_t numProcessed = 0;
+	fin >> buffer >> meanDivergence >> overlapCoverage;
+	if (!fin || buffer != "Parameters") throw parseError;
+	fin >> buffer >> numProcessed;
+	if (!fin || buffer != "Processed") throw parseError;
+
+	auto readIds = [&fin](std::vector<FastaRecord::Id>& reads)
+	{
+		size_t numReads = 0;
+		fin >> numReads;
+		for (size_t i = 0; i < numReads && fin; ++i)
+		{
+			uint32_t rawId = 0;
+			fin >> rawId;
+			reads.push_back(FastaRecord::Id(rawId));
+		}
+	};
+	std::vector<FastaRecord::Id> innerReads;
+	fin >> buffer;
+	if (buffer != "InnerReads") throw parseError;
+	readIds(innerReads);
+	std::vector<FastaRecord::Id> coveredReads;
+	fin >> buffer;
+	if (buffer != "CoveredReads") throw parseError;
+	readIds(coveredReads);
+
+	std::vector<ExtensionInfo> readLists;
+	while (fin >> buffer && buffer == "Disjointig")
+	{
+		ExtensionInfo exInfo;
+		fin >> exInfo.leftTip >> exInfo.rightTip >> exInfo.numSuspicious 
+			>> exInfo.meanOverlaps >> exInfo.stepsToTurn >> exInfo.assembledLength
+			>> exInfo.singleton >> exInfo.avgOverlapSize >> exInfo.minOverlapSize
+			>> exInfo.shortExtensions;
+		readIds(exInfo.reads);
+		if (!fin) throw parseError;
+		readLists.push_back(std::move(exInfo));
+	}
+	if (buffer != "End") throw parseError;
+
+	_ovlpContainer.setMeanDivergence(meanDivergence);
+	_chimDetector.setOverlapCoverage(overlapCoverage);
+	_innerReads.clear();
+	for (const auto& readId : innerReads) _innerReads.insert(readId, true);
+	_resumeCovered = std::move(coveredReads);
+	_readLists = std::move(readLists);
+	_resumeProcessed = numProcessed;
+	_resumed = true;
+
+	Logger::get().info() << "Resuming from checkpoint: " << _readLists.size()
+		<< " disjointigs, " << numProcessed << " reads processed";
+	return true;
+}
@@ -5,6 +5,8 @@
 #pragma once
 
 #include <deque>
+#include <chrono>
+#include <mutex>
 
 #include "../sequence/sequence_container.h"
 #include "../sequence/overlap.h"
@@ -20,9 +22,20 @@ public:
 		_safeOverlap(safeOverlap),
 		_readsContainer(readsContainer), 
 		_ovlpContainer(ovlpContainer),
-		_chimDetector(readsContainer, ovlpContainer)
+		_chimDetector(readsContainer, ovlpContainer),
+		_checkpointMinutes(0),
+		_resumed(false),
+		_resumeProcessed(0)
 	{}
 
+	//Periodically (every intervalMinutes, if non-zero) saves the state
+	//of the disjointig extension: the estimated parameters, finished
+	//disjointigs and covered / inner reads. loadCheckpoint() restores
+	//the state (if the checkpoint exists and matches the input), so that
+	//assembleDisjointigs() continues from where the previous run stopped
+	void setCheckpoint(const std::string& filename, float intervalMinutes);
+	bool loadCheckpoint();
+
 	void assembleDisjointigs();
 	const std::vector<ContigPath>& getDisjointigPaths() const
 		{return _disjointigPaths;}
@@ -63,6 +76,21 @@ private:
 	void  convertToDisjointigs();
 	std::vector<FastaRecord::Id> 
 		getInnerReads(const std::vector<OverlapRange>& ovlps);
+	//the checkpoint state is copied while the assembly is locked,
+	//and then written without blocking the other threads
+	struct CheckpointState
+	{
+		size_t numProcessed;
+		float  meanDivergence;
+		int    overlapCoverage;
+		std::vector<FastaRecord::Id> innerReads;
+		std::vector<FastaRecord::Id> coveredReads;
+		std::vector<ExtensionInfo> 	 readLists;
+	};
+	std::vector<size_t> checkpointSignature() const;
+	CheckpointState makeCheckpoint(cuckoohash_map<FastaRecord::Id, size_t>& coveredReads,
+								   size_t numProcessed);
+	void  writeCheckpoint(const CheckpointState& state);
 
 	const SequenceContainer& _readsContainer;
 	OverlapContainer& _ovlpContainer;
@@ -71,4 +99,12 @@ private:
 	std::vector<ExtensionInfo> 	_readLists;
 	std::vector<ContigPath> 	_disjointigPaths;
 	cuckoohash_map<FastaRecord::Id, size_t>  	_innerReads;
+
+	std::string _checkpointPath;
+	float _checkpointMinutes;
+	std::chrono::steady_clock::time_point _lastCheckpoint;
+	std::mutex _checkpointMutex;
+	bool   _resumed;
+	size_t _resumeProcessed;
+	std::vector<FastaRecord::Id> _resumeCovered;
 };
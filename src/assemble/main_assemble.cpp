@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <cmath>
+#include <cstdio>
+#include <numeric>
 #include <execinfo.h>
 
 #include "../sequence/vertex_index.h"
@@ -19,6 +21,7 @@
 #include "../common/logger.h"
 #include "../common/utils.h"
 #include "../common/memory_info.h"
+#include "../common/parallel.h"
 
 #include <getopt.h>
 
@@ -26,14 +29,16 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 			   std::string& outAssembly, std::string& logFile, size_t& genomeSize,
 			   int& kmerSize, bool& debug, size_t& numThreads, int& minOverlap, 
 			   std::string& configPath, int& minReadLength, bool& unevenCov, 
-			   std::string& extraParams, bool& shortMode)
+			   std::string& extraParams, bool& shortMode,
+			   std::string& checkpointPath)
 {
 	auto printUsage = []()
 	{
 		std::cerr << "Usage: flye-assemble "
 				  << " --reads path --out-asm path --config path [--genome-size size]\n"
 				  << "\t\t[--min-read length] [--log path] [--treads num] [--extra-params]\n"
-				  << "\t\t[--kmer size] [--meta] [--short] [--min-ovlp size] [--debug] [-h]\n\n"
+				  << "\t\t[--kmer size] [--meta] [--short] [--min-ovlp size] [--debug]\n"
+				  << "\t\t[--checkpoint path] [-h]\n\n"
 				  << "Required arguments:\n"
 				  << "  --reads path\tcomma-separated list of read files\n"
 				  << "  --out-asm path\tpath to output file\n"
@@ -53,6 +58,8 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 				  << "[default = not set] \n"
 				  << "  --log log_file\toutput log to file "
 				  << "[default = not set] \n"
+				  << "  --checkpoint path\tcheckpoint file, the assembly resumes "
+				  << "from it if exists [default = not set] \n"
 				  << "  --threads num_threads\tnumber of parallel threads "
 				  << "[default = 1] \n";
 	};
@@ -70,6 +77,7 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 		{"kmer", required_argument, 0, 0},
 		{"min-ovlp", required_argument, 0, 0},
 		{"extra-params", required_argument, 0, 0},
+		{"checkpoint", required_argument, 0, 0},
 		{"meta", no_argument, 0, 0},
 		{"short", no_argument, 0, 0},
 		{"debug", no_argument, 0, 0},
@@ -108,6 +116,8 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 				configPath = optarg;
 			else if (!strcmp(longOptions[optionIndex].name, "extra-params"))
 				extraParams = optarg;
+			else if (!strcmp(longOptions[optionIndex].name, "checkpoint"))
+				checkpointPath = optarg;
 			break;
 
 		case 'h':
@@ -125,11 +135,195 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 	return true;
 }
 
+//Sketch-based pre-filter for the contained disjointigs. Each disjointig
+//is sketched with FracMinHash (canonical k-mers with the hash in the
+//lowest 1/SCALE of the hash space). A shorter disjointig A is a candidate
+//for the containment in B if most of A's informative sketch hashes 
+//(allowing for the divergence) are shared with B, and the shared 
+//hashes span A up to the allowed flanks - so that the ordinary 
+//dovetail overlaps, that only share one end of A, are not reported.
+//Returns the disjointigs that belong to at least one candidate pair
+std::vector<bool> containmentCandidates(const std::vector<FastaRecord>& disjointigs,
+										float divergence, int flank)
+{
+	const size_t SCALE = 10;
+	const float MIN_CONTAINMENT = 0.8f;
+	const int32_t SPAN_SLACK = 1000;
+	const size_t MAX_HASH_FREQ = 1000;	//repetitive, not informative
+	const size_t hashThreshold = std::numeric_limits<size_t>::max() / SCALE;
+	const float kmerSurvival = std::exp(-divergence * Parameters::get().kmerSize);
+	const size_t numThreads = Parameters::get().numThreads;
+
+	std::vector<size_t> disjIds(disjointigs.size());
+	std::iota(disjIds.begin(), disjIds.end(), 0);
+
+	//sketches are sorted by hash, with the first position of each hash
+	struct SketchHash
+	{
+		size_t  hash;
+		int32_t pos;
+	};
+	std::vector<std::vector<SketchHash>> sketches(disjointigs.size());
+	std::function<void(const size_t&)> sketchParallel = 
+	[&disjointigs, &sketches, hashThreshold] (const size_t& disjId)
+	{
+		auto& sketch = sketches[disjId];
+		for (auto kmerPos : IterKmers(disjointigs[disjId].sequence))
+		{
+			kmerPos.kmer.standardForm();
+			size_t kmerHash = kmerPos.kmer.hash();
+			if (kmerHash < hashThreshold) 
+			{
+				sketch.push_back({kmerHash, kmerPos.position});
+			}
+		}
+		std::stable_sort(sketch.begin(), sketch.end(),
+						 [](const SketchHash& h1, const SketchHash& h2)
+						 {return h1.hash < h2.hash;});
+		sketch.erase(std::unique(sketch.begin(), sketch.end(),
+								 [](const SketchHash& h1, const SketchHash& h2)
+								 {return h1.hash == h2.hash;}), sketch.end());
+	};
+	processInParallel(disjIds, sketchParallel, numThreads, false);
+
+	//flat index of (hash, disjointig) pairs sorted by hash. It is built
+	//in parallel from the sorted sketches: each task collects one range
+	//of the hash space, so the concatenated ranges remain sorted
+	typedef std::pair<size_t, size_t> HashEntry;
+	const size_t numRanges = std::max((size_t)1, numThreads * 4);
+	std::vector<std::vector<HashEntry>> rangeEntries(numRanges);
+	std::vector<size_t> rangeIds(numRanges);
+	std::iota(rangeIds.begin(), rangeIds.end(), 0);
+	std::function<void(const size_t&)> indexParallel = 
+	[&sketches, &rangeEntries, numRanges, hashThreshold] (const size_t& rangeId)
+	{
+		const size_t rangeLen = hashThreshold / numRanges + 1;
+		const size_t rangeStart = rangeId * rangeLen;
+		const size_t rangeEnd = rangeStart + rangeLen;
+		auto byHash = [](const SketchHash& h, size_t value) 
+			{return h.hash < value;};
+		auto& entries = rangeEntries[rangeId];
+		for (size_t disjId = 0; disjId < sketches.size(); ++disjId)
+		{
+			auto it = std::lower_bound(sketches[disjId].begin(), 
+									   sketches[disjId].end(), 
+									   rangeStart, byHash);
+			for (; it != sketches[disjId].end() && it->hash < rangeEnd; ++it)
+			{
+				entries.emplace_back(it->hash, disjId);
+			}
+		}
+		std::sort(entries.begin(), entries.end());
+	};
+	processInParallel(rangeIds, indexParallel, numThreads, false);
+
+	std::vector<HashEntry> hashIndex;
+	size_t indexSize = 0;
+	for (const auto& entries : rangeEntries) indexSize += entries.size();
+	hashIndex.reserve(indexSize);
+	for (auto& entries : rangeEntries)
+	{
+		hashIndex.insert(hashIndex.end(), entries.begin(), entries.end());
+		std::vector<HashEntry>().swap(entries);
+	}
+
+	//for each disjointig, the (longer) disjointigs that might contain it
+	std::vector<std::vector<size_t>> containers(disjointigs.size());
+	std::function<void(const size_t&)> containParallel = 
+	[&disjointigs, &sketches, &hashIndex, &containers, MIN_CONTAINMENT, 
+		MAX_HASH_FREQ, SPAN_SLACK, kmerSurvival, flank] (const size_t& disjId)
+	{
+		struct SharedHashes
+		{
+			size_t  count;
+			int32_t minPos;
+			int32_t maxPos;
+		};
+
+		//containment is measured over the informative hashes only
+		std::unordered_map<size_t, SharedHashes> sharedHashes;
+		size_t informativeHashes = 0;
+		for (const auto& sketchHash : sketches[disjId])
+		{
+			auto range = std::equal_range(hashIndex.begin(), hashIndex.end(),
+										  HashEntry(sketchHash.hash, 0),
+										  [](const HashEntry& e1, const HashEntry& e2)
+										  {return e1.first < e2.first;});
+			if ((size_t)(range.second - range.first) > MAX_HASH_FREQ) continue;
+			++informativeHashes;
+			for (auto it = range.first; it != range.second; ++it)
+			{
+				if (it->second == disjId) continue;
+				auto shared = sharedHashes.find(it->second);
+				if (shared == sharedHashes.end())
+				{
+					sharedHashes[it->second] = {1, sketchHash.pos, sketchHash.pos};
+					continue;
+				}
+				++shared->second.count;
+				shared->second.minPos = std::min(shared->second.minPos, 
+												 sketchHash.pos);
+				shared->second.maxPos = std::max(shared->second.maxPos, 
+												 sketchHash.pos);
+			}
+		}
+
+		const int32_t disjLen = disjointigs[disjId].sequence.length();
+		const int32_t maxFlank = flank + SPAN_SLACK;
+		const float coreFraction = std::max(0.0f, 
+			float(disjLen - 2 * flank) / std::max(disjLen, 1));
+		for (const auto& shared : sharedHashes)
+		{
+			if (disjointigs[shared.first].sequence.length() < 
+				disjointigs[disjId].sequence.length()) continue;
+			if (shared.second.minPos > maxFlank ||
+				shared.second.maxPos < disjLen - maxFlank) continue;
+			if (shared.second.count >= MIN_CONTAINMENT * kmerSurvival * 
+										coreFraction * informativeHashes)
+			{
+				containers[disjId].push_back(shared.first);
+			}
+		}
+	};
+	processInParallel(disjIds, containParallel, numThreads, false);
+
+	std::vector<bool> candidates(disjointigs.size(), false);
+	for (size_t i = 0; i < containers.size(); ++i)
+	{
+		for (size_t containerId : containers[i])
+		{
+			candidates[i] = true;
+			candidates[containerId] = true;
+		}
+	}
+	return candidates;
+}
+
 void removeContainedDisjointigs(std::vector<FastaRecord>& disjointigs,
 								float divergenceThreshold)
 {
+	//optionally, only the disjointigs that are likely to be
+	//involved in containments are passed to the exact check
+	const int FLANK = (int)Config::get("maximum_overhang");
+	std::vector<bool> checkDisj(disjointigs.size(), true);
+	if ((bool)Config::get("sketch_contained_disjointigs"))
+	{
+		checkDisj = containmentCandidates(disjointigs, divergenceThreshold,
+										  FLANK);
+		size_t numCandidates = std::count(checkDisj.begin(), 
+										  checkDisj.end(), true);
+		Logger::get().debug() << "Containment candidates: " << numCandidates
+			<< " / " << disjointigs.size();
+		if (numCandidates == 0) return;
+	}
+
 	SequenceContainer disjSequences;
-	for (auto& disj : disjointigs) disjSequences.addSequence(disj.sequence, disj.description);
+	for (size_t i = 0; i < disjointigs.size(); ++i)
+	{
+		if (!checkDisj[i]) continue;
+		disjSequences.addSequence(disjointigs[i].sequence, 
+								  disjointigs[i].description);
+	}
 	disjSequences.buildPositionIndex();
 
 	VertexIndex vertIndex(disjSequences);
@@ -137,8 +331,6 @@ void removeContainedDisjointigs(std::vector<FastaRecord>& disjointigs,
 	int minWnd = useMinimizers ? Config::get("minimizer_window") : 1;
 	vertIndex.buildIndexMinimizers(/*min freq*/ 1, minWnd);
 
-	const int FLANK = (int)Config::get("maximum_overhang");
-
 	OverlapDetector ovlp(disjSequences, vertIndex,
 						 (int)Config::get("maximum_jump"), 
 						 Parameters::get().minimumOverlap,
@@ -204,10 +396,12 @@ int assemble_main(int argc, char** argv)
 	std::string logFile;
 	std::string configPath;
 	std::string extraParams;
+	std::string checkpointPath;
 
 	if (!parseArgs(argc, argv, readsFasta, outAssembly, logFile, genomeSize,
 				   kmerSize, debugging, numThreads, minOverlap, configPath, 
-				   minReadLength, unevenCov, extraParams, shortMode)) return 1;
+				   minReadLength, unevenCov, extraParams, shortMode,
+				   checkpointPath)) return 1;
 
 	Logger::get().setDebugging(debugging);
 	if (!logFile.empty()) Logger::get().setOutputFile(logFile);
@@ -226,6 +420,12 @@ int assemble_main(int argc, char** argv)
 	{
 		kmerSize = Config::get("kmer_size");
 	}
+	if ((size_t)kmerSize > Kmer::MAX_SIZE)
+	{
+		Logger::get().error() << "K-mer size " << kmerSize << " is not supported, "
+			<< "the maximum is " << (size_t)Kmer::MAX_SIZE;
+		return 1;
+	}
 	Parameters::get().numThreads = numThreads;
 	Parameters::get().kmerSize = kmerSize;
 	Parameters::get().minimumOverlap = minOverlap;
@@ -241,6 +441,26 @@ int assemble_main(int argc, char** argv)
 	Parameters::get().minimumOverlap = 1000;
 
 	SequenceContainer readsContainer;
+	VertexIndex vertexIndex(readsContainer);
+	vertexIndex.outputProgress(true);
+	size_t outSlash = outAssembly.find_last_of('/');
+	const std::string tempDir = outSlash != std::string::npos ? 
+								outAssembly.substr(0, outSlash) : ".";
+	vertexIndex.setTempDirectory(tempDir);
+
+	//k-mers of the solid k-mer index are counted over all reads
+	//while they are loaded, and do not depend on the reads order
+	bool useMinimizers = Config::get("use_minimizers");
+	SequenceContainer::SequenceCallback countKmers = nullptr;
+	if (!useMinimizers)
+	{
+		vertexIndex.startCountingKmers();
+		countKmers = [&vertexIndex](const DnaSequence& seq)
+		{
+			vertexIndex.addKmerSequence(seq);
+		};
+	}
+
 	std::vector<std::string> readsList = splitString(readsFasta, ',');
 	Logger::get().info() << "Reading sequences";
 	try
@@ -250,7 +470,7 @@ int assemble_main(int argc, char** argv)
 		minReadLength = std::max(minReadLength, minOverlap);
 		for (auto& readsFile : readsList)
 		{
-			readsContainer.loadFromFile(readsFile, minReadLength);
+			readsContainer.loadFromFile(readsFile, minReadLength, countKmers);
 		}
 	}
 	catch (SequenceContainer::ParseException& e)
@@ -259,8 +479,6 @@ int assemble_main(int argc, char** argv)
 		return 1;
 	}
 	readsContainer.buildPositionIndex();
-	VertexIndex vertexIndex(readsContainer);
-	vertexIndex.outputProgress(true);
 
 	/*int64_t sumLength = 0;
 	for (auto& seq : readsContainer.iterSeqs())
@@ -274,19 +492,58 @@ int assemble_main(int argc, char** argv)
 	static const float SELECT_RATE = Config::get("meta_read_top_kmer_rate");
 	static const int TANDEM_FREQ = Config::get("meta_read_filter_kmer_freq");
 
-	//Building index
-	bool useMinimizers = Config::get("use_minimizers");
-	if (useMinimizers)
+	//Optionally, reads are indexed in partitions of a bounded size
+	//(similarly to minimap2 batches), and the overlaps of all reads 
+	//against each partition are computed before the extension
+	std::vector<std::vector<FastaRecord::Id>> indexPartitions;
+	const size_t partitionSize = 
+		(size_t)Config::get("index_partition_mbp") * 1000000;
+	if (partitionSize > 0)
 	{
-		const int minWnd = Config::get("minimizer_window");
-		vertexIndex.buildIndexMinimizers(/*min freq*/ 1, minWnd);
+		size_t curLength = 0;
+		indexPartitions.emplace_back();
+		for (const auto& seq : readsContainer.iterSeqs())
+		{
+			if (!seq.id.strand()) continue;
+			if (curLength >= partitionSize)
+			{
+				indexPartitions.emplace_back();
+				curLength = 0;
+			}
+			indexPartitions.back().push_back(seq.id);
+			curLength += seq.sequence.length();
+		}
+		Logger::get().debug() << "Index partitions: " << indexPartitions.size();
 	}
-	else	//indexing using solid k-mers
+	const bool partitioned = indexPartitions.size() > 1;
+	if (partitioned) vertexIndex.setIndexedSequences(indexPartitions.front());
+
+	//Building index
+	auto buildIndex = [&vertexIndex, useMinimizers]()
+	{
+		if (useMinimizers)
+		{
+			const int minWnd = Config::get("minimizer_window");
+			vertexIndex.buildIndexMinimizers(/*min freq*/ 1, minWnd);
+		}
+		else	//indexing using solid k-mers
+		{
+			vertexIndex.buildIndexUnevenCoverage(MIN_FREQ, SELECT_RATE, 
+												 TANDEM_FREQ);
+		}
+	};
+	if (!useMinimizers)
 	{
-		vertexIndex.countKmers();
-		vertexIndex.buildIndexUnevenCoverage(MIN_FREQ, SELECT_RATE, 
-											 TANDEM_FREQ);
+		//k-mers are always counted over all reads, so with partitions
+		//the counts (and the repeat cutoff) are shared by all of them
+		vertexIndex.finishCountingKmers();
+		if (partitioned)
+		{
+			vertexIndex.setGlobalRepeatCutoff(MIN_FREQ, 
+										(float)Config::get("repeat_kmer_rate"));
+		}
 	}
+	buildIndex();
 
 	Logger::get().debug() << "Peak RAM usage: " 
 		<< getPeakRSS() / 1024 / 1024 / 1024 << " Gb";
@@ -303,12 +560,47 @@ int assemble_main(int argc, char** argv)
 						 /*partition bad map*/ false,
 						 (bool)Config::get("hpc_scoring_on"));
 	OverlapContainer readOverlaps(ovlp, readsContainer);
-	readOverlaps.estimateOverlaperParameters();
+	if (partitioned) readOverlaps.setTempDirectory(tempDir);
+	Extender extender(readsContainer, readOverlaps, minOverlap);
+
+	//the estimated parameters are restored from the checkpoint, if any
+	bool resumed = false;
+	if (!checkpointPath.empty())
+	{
+		extender.setCheckpoint(checkpointPath, 
+							   (float)Config::get("assemble_checkpoint_minutes"));
+		resumed = extender.loadCheckpoint();
+	}
+	if (!resumed) readOverlaps.estimateOverlaperParameters();
 	readOverlaps.setDivergenceThreshold((float)Config::get("assemble_ovlp_divergence"),
 										(bool)Config::get("assemble_divergence_relative"));
 
-	Extender extender(readsContainer, readOverlaps, minOverlap);
+	if (partitioned)
+	{
+		for (size_t i = 0; i < indexPartitions.size(); ++i)
+		{
+			if (i > 0)
+			{
+				vertexIndex.clearIndex();
+				vertexIndex.setIndexedSequences(indexPartitions[i]);
+				buildIndex();
+			}
+			Logger::get().info() << "Computing overlaps for index partition "
+				<< i + 1 << "/" << indexPartitions.size();
+			readOverlaps.addPartitionOverlaps();
+		}
+		vertexIndex.clear();
+		readOverlaps.finalizePartitions();
+
+		Logger::get().debug() << "Peak RAM usage: " 
+			<< getPeakRSS() / 1024 / 1024 / 1024 << " Gb";
+	}
+
+	const size_t cacheMb = (size_t)Config::get("overlap_cache_mb");
+	if (cacheMb > 0) readOverlaps.setCacheBudget(cacheMb * 1024 * 1024);
+
 	extender.assembleDisjointigs();
+	readOverlaps.overlapCacheStats();
 	vertexIndex.clear();
 
 	ConsensusGenerator consGen;
@@ -319,6 +611,7 @@ int assemble_main(int argc, char** argv)
 	removeContainedDisjointigs(disjointigsFasta, readOverlaps.getDivergenceThreshold());
 	//}
 	SequenceContainer::writeFasta(disjointigsFasta, outAssembly);
+	if (!checkpointPath.empty()) std::remove(checkpointPath.c_str());
 
 	Logger::get().debug() << "Peak RAM usage: " 
 		<< getPeakRSS() / 1024 / 1024 / 1024 << " Gb";
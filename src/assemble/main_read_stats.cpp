@@ -0,0 +1,292 @@
+//(c) 2020 by Authors
+//This file is a part of Flye program.
+//Released under the BSD license (see LICENSE file)
+
+//Read statistics for the run configuration: total length, N50/N90
+//and the length cutoff for the downsampling. The reads are only
+//parsed, but not stored, so the pass is cheap compared to the assembly
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <numeric>
+#include <map>
+#include <unordered_map>
+
+#include "../sequence/sequence_container.h"
+#include "../common/config.h"
+#include "../common/logger.h"
+#include "../common/utils.h"
+#include "../common/parallel.h"
+
+#include <getopt.h>
+
+namespace
+{
+	bool parseArgs(int argc, char** argv, std::string& readsFasta,
+				   std::string& outReport, std::string& logFile,
+				   size_t& minLength, size_t& targetLength,
+				   size_t& numThreads, bool& debug)
+	{
+		auto printUsage = []()
+		{
+			std::cerr << "Usage: flye-read-stats "
+					  << " --reads path --out path [--min-length size]\n"
+					  << "\t\t[--target-length size] [--log path] [--threads num]"
+					  << " [--debug] [-h]\n\n"
+					  << "Required arguments:\n"
+					  << "  --reads path\tcomma-separated list of read files\n"
+					  << "  --out path\tpath to output report\n\n"
+					  << "Optional arguments:\n"
+					  << "  --min-length size\tcount reads longer than size "
+					  << "[default = 0] \n"
+					  << "  --target-length size\tcompute the length cutoff that "
+					  << "keeps the longest reads of the given total length "
+					  << "[default = not set] \n"
+					  << "  --debug \t\tenable debug output "
+					  << "[default = false] \n"
+					  << "  --log log_file\toutput log to file "
+					  << "[default = not set] \n"
+					  << "  --threads num_threads\tnumber of parallel threads "
+					  << "[default = 1] \n";
+		};
+
+		int optionIndex = 0;
+		static option longOptions[] =
+		{
+			{"reads", required_argument, 0, 0},
+			{"out", required_argument, 0, 0},
+			{"min-length", required_argument, 0, 0},
+			{"target-length", required_argument, 0, 0},
+			{"log", required_argument, 0, 0},
+			{"threads", required_argument, 0, 0},
+			{"debug", no_argument, 0, 0},
+			{0, 0, 0, 0}
+		};
+
+		int opt = 0;
+		while ((opt = getopt_long(argc, argv, "h", longOptions, &optionIndex)) != -1)
+		{
+			switch(opt)
+			{
+			case 0:
+				if (!strcmp(longOptions[optionIndex].name, "reads"))
+					readsFasta = optarg;
+				else if (!strcmp(longOptions[optionIndex].name, "out"))
+					outReport = optarg;
+				else if (!strcmp(longOptions[optionIndex].name, "min-length"))
+					minLength = atoll(optarg);
+				else if (!strcmp(longOptions[optionIndex].name, "target-length"))
+					targetLength = atoll(optarg);
+				else if (!strcmp(longOptions[optionIndex].name, "log"))
+					logFile = optarg;
+				else if (!strcmp(longOptions[optionIndex].name, "threads"))
+					numThreads = atoi(optarg);
+				else if (!strcmp(longOptions[optionIndex].name, "debug"))
+					debug = true;
+				break;
+
+			case 'h':
+				printUsage();
+				exit(0);
+			}
+		}
+		if (readsFasta.empty() || outReport.empty())
+		{
+			printUsage();
+			return false;
+		}
+
+		return true;
+	}
+
+	//same as in the python pipeline: IUPAC codes are accepted,
+	//but converted to arbitrary ACGTs later
+	enum NuclClass {NUCL_ACGT = 0, NUCL_IUPAC = 1, NUCL_INVALID = 2};
+	std::vector<NuclClass> nuclClasses()
+	{
+		std::vector<NuclClass> classes(256, NUCL_INVALID);
+		for (char c : std::string("ACGTacgt")) classes[(size_t)c] = NUCL_ACGT;
+		for (char c : std::string("URYKMSWBDHVNXurykmswbvdhnx"))
+		{
+			classes[(size_t)c] = NUCL_IUPAC;
+		}
+		return classes;
+	}
+
+	//a part of an input file, parsed by a single worker
+	struct FileChunk
+	{
+		size_t fileId;
+		size_t start;
+		size_t end;
+	};
+
+	//read lengths are stored as a histogram (length -> number of reads),
+	//which is bounded by the maximum read length rather than the read count
+	struct ChunkStats
+	{
+		ChunkStats(): nonAcgtReads(0) {}
+
+		std::unordered_map<size_t, size_t> lengthCounts;
+		size_t nonAcgtReads;
+		std::string error;
+	};
+
+	//the first length (starting from the longest reads) at which
+	//the cumulative length exceeds the threshold (0 if never)
+	size_t lengthAtCumulative(const std::map<size_t, size_t>& lengthCounts,
+							  double threshold)
+	{
+		size_t cumulative = 0;
+		for (auto it = lengthCounts.rbegin(); it != lengthCounts.rend(); ++it)
+		{
+			cumulative += it->first * it->second;
+			if (cumulative > threshold) return it->first;
+		}
+		return 0;
+	}
+}
+
+int read_stats_main(int argc, char** argv)
+{
+	#ifdef NDEBUG
+	signal(SIGSEGV, segfaultHandler);
+	std::set_terminate(exceptionHandler);
+	#endif
+
+	std::string readsFasta;
+	std::string outReport;
+	std::string logFile;
+	size_t minLength = 0;
+	size_t targetLength = 0;
+	size_t numThreads = 1;
+	bool debugging = false;
+
+	if (!parseArgs(argc, argv, readsFasta, outReport, logFile, minLength,
+				   targetLength, numThreads, debugging)) return 1;
+
+	Logger::get().setDebugging(debugging);
+	if (!logFile.empty()) Logger::get().setOutputFile(logFile);
+	Logger::get().debug() << "Build date: " << __DATE__ << " " << __TIME__;
+	std::ios::sync_with_stdio(false);
+
+	//input files are parsed in parallel, large uncompressed files 
+	//are also split into chunks. Compressed files are parsed by a single
+	//worker, since the decompression could not start in the middle
+	const size_t CHUNK_SIZE = 256 * 1024 * 1024;
+	std::vector<std::string> readsList = splitString(readsFasta, ',');
+	std::vector<FileChunk> chunks;
+	try
+	{
+		for (size_t fileId = 0; fileId < readsList.size(); ++fileId)
+		{
+			SequenceContainer parser;
+			auto bounds = parser.splitFile(readsList[fileId], CHUNK_SIZE);
+			for (size_t i = 0; i + 1 < bounds.size(); ++i)
+			{
+				chunks.push_back({fileId, bounds[i], bounds[i + 1]});
+			}
+		}
+	}
+	catch (SequenceContainer::ParseException& e)
+	{
+		Logger::get().error() << e.what();
+		return 1;
+	}
+	std::vector<ChunkStats> chunkStats(chunks.size());
+	std::vector<size_t> chunkIds(chunks.size());
+	std::iota(chunkIds.begin(), chunkIds.end(), 0);
+
+	Logger::get().info() << "Collecting read statistics";
+	Logger::get().debug() << "Parsing " << readsList.size() << " files in "
+		<< chunks.size() << " chunks";
+	const auto classes = nuclClasses();
+	std::function<void(const size_t&)> scanChunk =
+	[&readsList, &chunks, &chunkStats, &classes] (const size_t& chunkId)
+	{
+		auto& stats = chunkStats[chunkId];
+		SequenceContainer::RecordCallback addRecord =
+		[&stats, &classes] (std::string&, std::string& sequence)
+		{
+			int worstClass = NUCL_ACGT;
+			for (char c : sequence)
+			{
+				worstClass = std::max(worstClass, (int)classes[(uint8_t)c]);
+			}
+			if (worstClass == NUCL_INVALID)
+			{
+				throw SequenceContainer::ParseException("invalid character");
+			}
+			if (worstClass == NUCL_IUPAC) ++stats.nonAcgtReads;
+			++stats.lengthCounts[sequence.length()];
+		};
+
+		const FileChunk& chunk = chunks[chunkId];
+		try
+		{
+			SequenceContainer parser;
+			parser.parseFile(readsList[chunk.fileId], addRecord,
+							 chunk.start, chunk.end);
+		}
+		catch (SequenceContainer::ParseException& e)
+		{
+			stats.error = e.what();
+		}
+	};
+	processInParallel(chunkIds, scanChunk, numThreads, /*progress*/ false);
+
+	std::map<size_t, size_t> lengthCounts;
+	size_t nonAcgtReads = 0;
+	for (auto& stats : chunkStats)
+	{
+		if (!stats.error.empty())
+		{
+			Logger::get().error() << stats.error;
+			return 1;
+		}
+		for (const auto& lenCount : stats.lengthCounts)
+		{
+			lengthCounts[lenCount.first] += lenCount.second;
+		}
+		nonAcgtReads += stats.nonAcgtReads;
+		stats.lengthCounts.clear();
+	}
+
+	size_t numReads = 0;
+	size_t totalLength = 0;
+	size_t passingReads = 0;
+	for (const auto& lenCount : lengthCounts)
+	{
+		numReads += lenCount.second;
+		totalLength += lenCount.first * lenCount.second;
+		if (lenCount.first > minLength) passingReads += lenCount.second;
+	}
+	size_t readsN50 = lengthAtCumulative(lengthCounts, 0.50 * totalLength);
+	size_t readsN90 = lengthAtCumulative(lengthCounts, 0.90 * totalLength);
+	Logger::get().debug() << "Reads: " << numReads
+		<< ", total length: " << totalLength
+		<< ", N50/N90: " << readsN50 << " / " << readsN90;
+
+	std::ofstream fout(outReport);
+	if (!fout) throw std::runtime_error("Can't open " + outReport);
+	fout << "reads " << numReads << "\n"
+		<< "total_length " << totalLength << "\n"
+		<< "max_read_length " << (lengthCounts.empty() ? 0 : 
+								  lengthCounts.rbegin()->first) << "\n"
+		<< "passing_reads " << passingReads << "\n"
+		<< "non_acgt_reads " << nonAcgtReads << "\n"
+		<< "reads_n50 " << readsN50 << "\n"
+		<< "reads_n90 " << readsN90 << "\n";
+	if (targetLength > 0)
+	{
+		fout << "downsample_cutoff "
+			<< lengthAtCumulative(lengthCounts, targetLength) << "\n";
+	}
+
+	return 0;
+}
@@ -0,0 +1,181 @@
+//(c) 2020 by Authors
+//This file is a part of Flye program.
+//Released under the BSD license (see LICENSE file)
+
+//Static interval index (similar to cgranges). Intervals are sorted
+//by start and stored in a single contiguous array, which is viewed
+//as an implicit balanced binary tree: the nodes of level k are the
+//elements with the k lowest index bits set to one. Each node also
+//keeps the maximum end over its subtree, so the queries skip the
+//subtrees that end before the query start. Unlike the pointer-based
+//trees, there are no per-node allocations, and queries only touch
+//contiguous memory. Interval ends are inclusive.
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+template <class T, typename K = int32_t>
+class IntervalIndex
+{
+public:
+	struct Interval
+	{
+		Interval(K start, K stop, const T& value):
+			start(start), stop(stop), value(value) {}
+
+		K start;
+		K stop;
+		T value;
+	};
+
+	IntervalIndex(): _maxLevel(-1) {}
+
+	explicit IntervalIndex(const std::vector<Interval>& intervals):
+		_maxLevel(-1)
+	{
+		_nodes.reserve(intervals.size());
+		for (const auto& interval : intervals) _nodes.emplace_back(interval);
+
+		//stable, so the intervals with the same start are reported
+		//in the order of addition
+		std::stable_sort(_nodes.begin(), _nodes.end(),
+						 [](const Node& n1, const Node& n2)
+						 {return n1.interval.start < n2.interval.start;});
+		this->index();
+	}
+
+	size_t size() const {return _nodes.size();}
+
+	//calls the function for each interval that intersects [start, stop],
+	//in the order of interval starts
+	template <class F>
+	void forEachOverlapping(K start, K stop, F&& fn) const
+	{
+		if (_maxLevel < 0) return;
+
+		const size_t SCAN_LEVEL = 3;	//small subtrees are scanned linearly
+		const int64_t numNodes = _nodes.size();
+
+		struct StackItem
+		{
+			int64_t node;
+			int level;
+			bool leftVisited;
+		};
+		StackItem stack[64];
+		int stackSize = 0;
+		stack[stackSize++] = {((int64_t)1 << _maxLevel) - 1, _maxLevel, false};
+
+		while (stackSize > 0)
+		{
+			StackItem item = stack[--stackSize];
+			if (item.level <= (int)SCAN_LEVEL)
+			{
+				int64_t first = item.node >> item.level << item.level;
+				int64_t last = std::min(numNodes, first +
+										((int64_t)1 << (item.level + 1)) - 1);
+				for (int64_t i = first; i < last &&
+					 _nodes[i].interval.start <= stop; ++i)
+				{
+					if (_nodes[i].interval.stop >= start) fn(_nodes[i].interval);
+				}
+			}
+			else if (!item.leftVisited)
+			{
+				//the left subtree is visited first, unless it ends
+				//before the query start
+				int64_t left = item.node - ((int64_t)1 << (item.level - 1));
+				stack[stackSize++] = {item.node, item.level, true};
+				if (left >= numNodes || _nodes[left].maxStop >= start)
+				{
+					stack[stackSize++] = {left, item.level - 1, false};
+				}
+			}
+			else if (item.node < numNodes &&
+					 _nodes[item.node].interval.start <= stop)
+			{
+				if (_nodes[item.node].interval.stop >= start)
+				{
+					fn(_nodes[item.node].interval);
+				}
+				int64_t right = item.node + ((int64_t)1 << (item.level - 1));
+				stack[stackSize++] = {right, item.level - 1, false};
+			}
+		}
+	}
+
+	std::vector<Interval> findOverlapping(K start, K stop) const
+	{
+		std::vector<Interval> overlapping;
+		this->forEachOverlapping(start, stop,
+								 [&overlapping](const Interval& interval)
+								 {overlapping.push_back(interval);});
+		return overlapping;
+	}
+
+	std::vector<Interval> findStabbing(K position) const
+	{
+		return this->findOverlapping(position, position);
+	}
+
+private:
+	struct Node
+	{
+		Node(const Interval& interval):
+			interval(interval), maxStop(interval.stop) {}
+
+		Interval interval;
+		K maxStop;
+	};
+
+	//computes the subtree maximum ends, level by level
+	void index()
+	{
+		const int64_t numNodes = _nodes.size();
+		if (numNodes == 0)
+		{
+			_maxLevel = -1;
+			return;
+		}
+
+		int64_t lastNode = 0;
+		K lastMax = 0;
+		for (int64_t i = 0; i < numNodes; i += 2)
+		{
+			lastNode = i;
+			lastMax = _nodes[i].maxStop = _nodes[i].interval.stop;
+		}
+
+		int level = 1;
+		for (; ((int64_t)1 << level) <= numNodes; ++level)
+		{
+			const int64_t half = (int64_t)1 << (level - 1);
+			const int64_t firstNode = (half << 1) - 1;
+			const int64_t step = half << 2;
+			for (int64_t i = firstNode; i < numNodes; i += step)
+			{
+				K leftMax = _nodes[i - half].maxStop;
+				K rightMax = i + half < numNodes ?
+							 _nodes[i + half].maxStop : lastMax;
+				_nodes[i].maxStop = std::max(_nodes[i].interval.stop,
+											 std::max(leftMax, rightMax));
+			}
+
+			//the last node of the array might not have a parent
+			//at this level, so its maximum is carried separately
+			lastNode = ((lastNode >> level) & 1) ? lastNode - half :
+												   lastNode + half;
+			if (lastNode < numNodes)
+			{
+				lastMax = std::max(lastMax, _nodes[lastNode].maxStop);
+			}
+		}
+		_maxLevel = level - 1;
+	}
+
+	std::vector<Node> _nodes;
+	int _maxLevel;
+};
@@ -2,19 +2,28 @@
 //This file is a part of ABruijn program.
 //Released under the BSD license (see LICENSE file)
 
+#pragma once
+
 #include <vector>
 #include <functional>
 #include <atomic>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <exception>
 
 #include "progress_bar.h"
 
 //simple thread pool implementation
-//updateFun should be thread-safe!
+//updateFun should be thread-safe! It also gets the index of the worker
+//thread (in range [0, maxThreads)), so the callers could accumulate 
+//results into per-thread buffers without locking
 template <class T>
-void processInParallel(const std::vector<T>& scheduledTasks,
-					   std::function<void(const T&)> updateFun,
-					   size_t maxThreads, bool progressBar)
+void processInParallelThreaded(const std::vector<T>& scheduledTasks,
+							   std::function<void(const T&, size_t)> updateFun,
+							   size_t maxThreads, bool progressBar)
 {
 	if (scheduledTasks.empty()) return;
 
@@ -23,7 +32,7 @@ void processInParallel(const std::vector<T>& scheduledTasks,
 	if (progressBar) progress.advance(0);
 
 	auto threadWorker = [&jobId, &scheduledTasks, &updateFun, 
-						 &progress, progressBar]()
+						 &progress, progressBar](size_t threadId)
 	{
 		while (true)
 		{
@@ -40,7 +49,7 @@ void processInParallel(const std::vector<T>& scheduledTasks,
 					break;
 				}
 			}
-			updateFun(scheduledTasks[expected]);
+			updateFun(scheduledTasks[expected], threadId);
 			if (progressBar) progress.advance();
 		}
 	};
@@ -49,7 +58,7 @@ void processInParallel(const std::vector<T>& scheduledTasks,
 											  scheduledTasks.size()));
 	for (size_t i = 0; i < threads.size(); ++i)
 	{
-		threads[i] = std::thread(threadWorker);
+		threads[i] = std::thread(threadWorker, i);
 	}
 	for (size_t i = 0; i < threads.size(); ++i)
 	{
@@ -57,3 +66,139 @@ void processInParallel(const std::vector<T>& scheduledTasks,
 	}
 }
 
+//same as above, for the functions that do not need the thread index
+template <class T>
+void processInParallel(const std::vector<T>& scheduledTasks,
+					   std::function<void(const T&)> updateFun,
+					   size_t maxThreads, bool progressBar)
+{
+	std::function<void(const T&, size_t)> threadedFun = 
+		[&updateFun] (const T& task, size_t) {updateFun(task);};
+	processInParallelThreaded(scheduledTasks, threadedFun, 
+							  maxThreads, progressBar);
+}
+
+
+//ordered producer / consumer pipeline. produceFun runs in a separate
+//thread and passes the items to the given callback, processFun is
+//applied to the items in parallel, and consumeFun is called on
+//the current thread, in the order in which the items were produced.
+//At most maxQueued items are in flight, so the producer waits if
+//the processing falls behind. Exceptions thrown by any of the functions
+//stop the pipeline and are rethrown to the caller
+template <class T>
+void processInPipeline(std::function<void(std::function<void(T&&)>)> produceFun,
+					   std::function<void(T&)> processFun,
+					   std::function<void(T&)> consumeFun,
+					   size_t maxThreads, size_t maxQueued)
+{
+	struct Item
+	{
+		Item(T&& data): data(std::move(data)), ready(false) {}
+		T data;
+		bool ready;
+	};
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::deque<std::unique_ptr<Item>> inFlight;
+	size_t numConsumed = 0;		//items that left the queue
+	size_t numClaimed = 0;		//items taken by the workers
+	bool producerDone = false;
+	bool aborted = false;
+	std::exception_ptr error;
+
+	auto abort = [&mutex, &changed, &aborted, &error]()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!error) error = std::current_exception();
+		aborted = true;
+		changed.notify_all();
+	};
+
+	auto producer = [&]()
+	{
+		try
+		{
+			produceFun([&](T&& data)
+			{
+				std::unique_ptr<Item> item(new Item(std::move(data)));
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&]()
+							 {return aborted || inFlight.size() < maxQueued;});
+				if (aborted) throw std::runtime_error("Pipeline aborted");
+				inFlight.push_back(std::move(item));
+				changed.notify_all();
+			});
+			std::lock_guard<std::mutex> lock(mutex);
+			producerDone = true;
+			changed.notify_all();
+		}
+		catch (...)
+		{
+			abort();
+		}
+	};
+
+	auto worker = [&]()
+	{
+		try
+		{
+			while (true)
+			{
+				Item* item = nullptr;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					changed.wait(lock, [&]()
+						{return aborted || producerDone ||
+								numClaimed < numConsumed + inFlight.size();});
+					if (aborted) return;
+					if (numClaimed == numConsumed + inFlight.size()) return;
+					item = inFlight[numClaimed - numConsumed].get();
+					++numClaimed;
+				}
+				processFun(item->data);
+
+				std::lock_guard<std::mutex> lock(mutex);
+				item->ready = true;
+				changed.notify_all();
+			}
+		}
+		catch (...)
+		{
+			abort();
+		}
+	};
+
+	std::thread producerThread(producer);
+	std::vector<std::thread> workers(std::max((size_t)1, maxThreads));
+	for (auto& thread : workers) thread = std::thread(worker);
+
+	try
+	{
+		while (true)
+		{
+			std::unique_ptr<Item> item;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&]()
+					{return aborted || (producerDone && inFlight.empty()) ||
+							(!inFlight.empty() && inFlight.front()->ready);});
+				if (aborted || inFlight.empty()) break;
+				item = std::move(inFlight.front());
+				inFlight.pop_front();
+				++numConsumed;
+				changed.notify_all();
+			}
+			consumeFun(item->data);
+		}
+	}
+	catch (...)
+	{
+		abort();
+	}
+
+	producerThread.join();
+	for (auto& thread : workers) thread.join();
+	if (error) std::rethrow_exception(error);
+}
@@ -9,12 +9,14 @@ int assemble_main(int argc, char** argv);
 int repeat_main(int argc, char** argv);
 int contigger_main(int argc, char** argv);
 int polisher_main(int argc, char** argv);
+int aligner_main(int argc, char** argv);
+int read_stats_main(int argc, char** argv);
 
 int main(int argc, char** argv)
 {
 	if (argc < 2)
 	{
-		std::cerr << "Usage: flye-modules [assemble | repeat | contigger | polisher] ..." 
+		std::cerr << "Usage: flye-modules [assemble | repeat | contigger | polisher | align | read-stats] ..." 
 				  << std::endl;
 		return 1;
 	}
@@ -35,9 +37,17 @@ int main(int argc, char** argv)
 	{
 		return polisher_main(argc - 1, argv + 1);
 	}
+	else if (module == "align")
+	{
+		return aligner_main(argc - 1, argv + 1);
+	}
+	else if (module == "read-stats")
+	{
+		return read_stats_main(argc - 1, argv + 1);
+	}
 	else
 	{
-		std::cerr << "Usage: flye-modules [assemble | repeat | contigger | polisher] ..." 
+		std::cerr << "Usage: flye-modules [assemble | repeat | contigger | polisher | align | read-stats] ..." 
 				  << std::endl;
 		return 1;
 	}
@@ -0,0 +1,127 @@
+//(c) 2020 by Authors
+//This file is a part of Flye program.
+//Released under the BSD license (see LICENSE file)
+
+#include <iostream>
+#include <getopt.h>
+#include <cstring>
+
+#include "../polishing/minimap_aligner.h"
+#include "../polishing/utility.h"
+#include "../common/logger.h"
+
+
+namespace
+{
+bool parseArgs(int argc, char** argv, std::string& contigsFile,
+			   std::string& readsFiles, std::string& platform,
+			   std::string& outFile,
+			   int& windowSize, size_t& memoryMb,
+			   int& numThreads, bool& debug)
+{
+	auto printUsage = []()
+	{
+		std::cerr << "Usage: flye-modules align "
+				  << " --contigs path --reads path --platform (nano|pacbio) --out path\n"
+				  << "\t\t[--window size] [--memory mb] [--threads num]\n"
+				  << "\t\t[--debug] [-h]\n\n"
+				  << "Required arguments:\n"
+				  << "  --contigs path\tpath to contigs file\n"
+				  << "  --reads path\tcomma-separated list of read files\n"
+				  << "  --platform name\tsequencing platform (nano or pacbio)\n"
+				  << "  --out path\tpath to output bucketed alignment\n\n"
+				  << "Optional arguments:\n"
+				  << "  --window size\tcontig window size "
+				  << "[default = 1000000] \n"
+				  << "  --memory mb\tmemory budget for alignment buckets "
+				  << "[default = 4096] \n"
+				  << "  --debug \t\textra debug output "
+				  << "[default = false] \n"
+				  << "  --threads num_threads\tnumber of parallel threads "
+				  << "[default = 1] \n";
+	};
+
+	int optionIndex = 0;
+	static option longOptions[] =
+	{
+		{"contigs", required_argument, 0, 0},
+		{"reads", required_argument, 0, 0},
+		{"platform", required_argument, 0, 0},
+		{"out", required_argument, 0, 0},
+		{"window", required_argument, 0, 0},
+		{"memory", required_argument, 0, 0},
+		{"threads", required_argument, 0, 0},
+		{"debug", no_argument, 0, 0},
+		{0, 0, 0, 0}
+	};
+
+	int opt = 0;
+	while ((opt = getopt_long(argc, argv, "h", longOptions, &optionIndex)) != -1)
+	{
+		switch(opt)
+		{
+		case 0:
+			if (!strcmp(longOptions[optionIndex].name, "threads"))
+				numThreads = atoi(optarg);
+			else if (!strcmp(longOptions[optionIndex].name, "debug"))
+				debug = true;
+			else if (!strcmp(longOptions[optionIndex].name, "contigs"))
+				contigsFile = optarg;
+			else if (!strcmp(longOptions[optionIndex].name, "reads"))
+				readsFiles = optarg;
+			else if (!strcmp(longOptions[optionIndex].name, "platform"))
+				platform = optarg;
+			else if (!strcmp(longOptions[optionIndex].name, "out"))
+				outFile = optarg;
+			else if (!strcmp(longOptions[optionIndex].name, "window"))
+				windowSize = atoi(optarg);
+			else if (!strcmp(longOptions[optionIndex].name, "memory"))
+				memoryMb = atol(optarg);
+			break;
+
+		case 'h':
+			printUsage();
+			exit(0);
+		}
+	}
+	if (contigsFile.empty() || readsFiles.empty() ||
+		platform.empty() || outFile.empty() || windowSize <= 0)
+	{
+		printUsage();
+		return false;
+	}
+
+	return true;
+}
+}
+
+int aligner_main(int argc, char* argv[])
+{
+	std::string contigsFile;
+	std::string readsFiles;
+	std::string platform;
+	std::string outFile;
+	int windowSize = 1000000;
+	size_t memoryMb = 4096;
+	int numThreads = 1;
+	bool debug = false;
+
+	if (!parseArgs(argc, argv, contigsFile, readsFiles, platform, outFile,
+				   windowSize, memoryMb, numThreads, debug))
+		return 1;
+
+	Logger::get().setDebugging(debug);
+	try
+	{
+		MinimapAligner aligner(contigsFile, platform, numThreads);
+		aligner.alignReads(splitString(readsFiles, ','), outFile,
+						   windowSize, memoryMb * 1024 * 1024);
+	}
+	catch (std::runtime_error& e)
+	{
+		Logger::get().error() << e.what();
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,333 @@
+//(c) 2020 by Authors
+//This file is a part of Flye program.
+//Released under the BSD license (see LICENSE file)
+
+#include <stdexcept>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+
+#include "minimap_aligner.h"
+#include "../common/parallel.h"
+#include "../common/logger.h"
+
+
+namespace
+{
+	//number of read bases that are loaded and mapped at once
+	const int64_t READS_BATCH = 500000000;
+
+	//size of the fixed part of a binary alignment record
+	const size_t RECORD_HEADER = 40;
+
+	char complementUpper(char c)
+	{
+		switch (c)
+		{
+			case 'A': case 'a': return 'T';
+			case 'C': case 'c': return 'G';
+			case 'G': case 'g': return 'C';
+			case 'T': case 't': return 'A';
+			default: return 'N';
+		}
+	}
+
+	template <class T>
+	void appendValue(std::string& buffer, T value)
+	{
+		buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+}
+
+AlignmentBuckets::AlignmentBuckets(const std::string& outPath,
+								   size_t memoryBudget):
+	_outOffset(0), _memoryBudget(memoryBudget), _bufferedBytes(0),
+	_numRecords(0), _numSpills(0)
+{
+	_outFile = fopen(outPath.c_str(), "wb");
+	if (!_outFile)
+	{
+		throw std::runtime_error("Can't open " + outPath);
+	}
+}
+
+AlignmentBuckets::~AlignmentBuckets()
+{
+	if (_outFile) fclose(_outFile);
+}
+
+void AlignmentBuckets::addRecord(size_t windowId, const std::string& record,
+								 int32_t recordEnd)
+{
+	if (windowId >= _buffers.size())
+	{
+		_buffers.resize(windowId + 1);
+		_segments.resize(windowId + 1);
+		_maxEnd.resize(windowId + 1, 0);
+	}
+	_buffers[windowId] += record;
+	_maxEnd[windowId] = std::max(_maxEnd[windowId], recordEnd);
+	_bufferedBytes += record.size();
+	++_numRecords;
+
+	if (_bufferedBytes > _memoryBudget)
+	{
+		this->flush();
+		++_numSpills;
+	}
+}
+
+//writes all non-empty buckets into the output file, each bucket
+//as a contiguous segment
+void AlignmentBuckets::flush()
+{
+	for (size_t i = 0; i < _buffers.size(); ++i)
+	{
+		if (_buffers[i].empty()) continue;
+
+		if (fwrite(_buffers[i].data(), 1, _buffers[i].size(),
+				   _outFile) != _buffers[i].size())
+		{
+			throw std::runtime_error("Error writing alignment buckets");
+		}
+		_segments[i].push_back({_outOffset, _buffers[i].size()});
+		_outOffset += _buffers[i].size();
+
+		std::string().swap(_buffers[i]);
+	}
+	_bufferedBytes = 0;
+	fflush(_outFile);
+}
+
+//index format: one line per segment
+//contig_name window_start window_end offset length max_record_end
+void AlignmentBuckets::writeIndex(const std::string& indexPath,
+								  const std::vector<ContigWindow>& windows,
+								  const mm_idx_t* index)
+{
+	this->flush();
+
+	FILE* fout = fopen(indexPath.c_str(), "w");
+	if (!fout)
+	{
+		throw std::runtime_error("Can't open " + indexPath);
+	}
+	for (size_t i = 0; i < std::min(windows.size(), _segments.size()); ++i)
+	{
+		for (auto& seg : _segments[i])
+		{
+			fprintf(fout, "%s\t%d\t%d\t%lu\t%lu\t%d\n",
+					index->seq[windows[i].ctgId].name, windows[i].start,
+					windows[i].end, (unsigned long)seg.offset,
+					(unsigned long)seg.length, _maxEnd[i]);
+		}
+	}
+	fclose(fout);
+}
+
+MinimapAligner::MinimapAligner(const std::string& contigsPath,
+							   const std::string& platform, int numThreads):
+	_index(nullptr), _numThreads(numThreads)
+{
+	//same settings as for the minimap2 binary in the python part:
+	//-x map-ont/map-pb -p 0.5 -N 10 -z 1000 -I 64G
+	mm_verbose = 1;
+	mm_idxopt_t idxOpt;
+	mm_set_opt(0, &idxOpt, &_mapOpt);
+	std::string preset = platform == "pacbio" ? "map-pb" : "map-ont";
+	if (mm_set_opt(preset.c_str(), &idxOpt, &_mapOpt) < 0)
+	{
+		throw std::runtime_error("Unknown minimap2 preset " + preset);
+	}
+	_mapOpt.flag |= MM_F_CIGAR;
+	_mapOpt.pri_ratio = 0.5f;
+	_mapOpt.best_n = 10;
+	_mapOpt.zdrop = _mapOpt.zdrop_inv = 1000;
+	idxOpt.batch_size = 64ULL * 1024 * 1024 * 1024;
+
+	mm_idx_reader_t* reader = mm_idx_reader_open(contigsPath.c_str(),
+												 &idxOpt, 0);
+	if (!reader)
+	{
+		throw std::runtime_error("Can't open " + contigsPath);
+	}
+	_index = mm_idx_reader_read(reader, numThreads);
+	mm_idx_reader_close(reader);
+	if (!_index)
+	{
+		throw std::runtime_error("Empty contigs file: " + contigsPath);
+	}
+	mm_mapopt_update(&_mapOpt, _index);
+	if (mm_check_opt(&idxOpt, &_mapOpt) < 0)
+	{
+		throw std::runtime_error("Incompatible minimap2 options");
+	}
+
+	Logger::get().debug() << "Indexed " << _index->n_seq << " contigs";
+}
+
+MinimapAligner::~MinimapAligner()
+{
+	if (_index) mm_idx_destroy(_index);
+}
+
+//windows are the same as produced by the python SynchonizedChunkManager:
+//the last window of a contig is extended up to its end
+void MinimapAligner::makeWindows(int windowSize)
+{
+	_windows.clear();
+	_firstWindow.clear();
+	for (uint32_t ctgId = 0; ctgId < _index->n_seq; ++ctgId)
+	{
+		_firstWindow.push_back(_windows.size());
+		int32_t ctgLen = _index->seq[ctgId].len;
+		int32_t numWindows = std::max(ctgLen / windowSize, 1);
+		for (int32_t i = 0; i < numWindows; ++i)
+		{
+			int32_t start = i * windowSize;
+			int32_t end = (i + 1) * windowSize;
+			if (ctgLen - end < windowSize) end = ctgLen;
+			_windows.push_back({ctgId, start, end});
+		}
+	}
+	_firstWindow.push_back(_windows.size());
+}
+
+//Converts the alignment into a binary record (see the header for
+//the format). Only the aligned part of the read is stored. Since the
+//clipping changes the query length that "samtools depth -l" filters on,
+//the query length of the unclipped record (as minimap2 would output it:
+//the whole read for primary alignments, the aligned part otherwise)
+//is also kept.
+void MinimapAligner::makeRecord(const mm_reg1_t& r, const mm_bseq1_t& read,
+								BucketedRecord& rec) const
+{
+	uint16_t flag = 0;
+	if (r.rev) flag |= 0x10;
+	if (r.parent != r.id) flag |= 0x100;
+	else if (!r.sam_pri) flag |= 0x800;
+
+	const int32_t alnLen = r.qe - r.qs;
+	const int32_t clipLeft = r.rev ? read.l_seq - r.qe : r.qs;
+	const int32_t clipRight = read.l_seq - alnLen - clipLeft;
+	const int32_t origQryLen = (flag & 0x900) ? alnLen : read.l_seq;
+	const uint32_t nameLen = strlen(read.name);
+
+	std::string& data = rec.data;
+	data.reserve(RECORD_HEADER + nameLen + r.p->n_cigar * sizeof(uint32_t) + alnLen);
+	appendValue<uint32_t>(data, r.rid);
+	appendValue<int32_t>(data, r.rs);
+	appendValue<int32_t>(data, r.re);
+	appendValue<int32_t>(data, clipLeft);
+	appendValue<int32_t>(data, clipRight);
+	appendValue<int32_t>(data, origQryLen);
+	appendValue<uint16_t>(data, flag);
+	appendValue<uint8_t>(data, r.mapq);
+	appendValue<uint8_t>(data, 0);
+	appendValue<uint32_t>(data, nameLen);
+	appendValue<uint32_t>(data, r.p->n_cigar);
+	appendValue<uint32_t>(data, alnLen);
+	data.append(read.name, nameLen);
+	data.append(reinterpret_cast<const char*>(r.p->cigar),
+				r.p->n_cigar * sizeof(uint32_t));
+	for (int32_t pos = 0; pos < alnLen; ++pos)
+	{
+		if (!r.rev)
+		{
+			data += toupper(read.seq[r.qs + pos]);
+		}
+		else
+		{
+			data += complementUpper(read.seq[r.qe - 1 - pos]);
+		}
+	}
+
+	//the record goes to the window where it starts
+	rec.end = r.re;
+	rec.window = _firstWindow[r.rid];
+	while (rec.window + 1 < _firstWindow[r.rid + 1] &&
+		   _windows[rec.window].end <= r.rs) ++rec.window;
+}
+
+void MinimapAligner::alignReads(const std::vector<std::string>& readsPaths,
+								const std::string& outPath, int windowSize,
+								size_t memoryBudget)
+{
+	this->makeWindows(windowSize);
+	AlignmentBuckets buckets(outPath, memoryBudget);
+
+	std::vector<mm_tbuf_t*> threadBuffers;
+	for (int i = 0; i < _numThreads; ++i)
+	{
+		threadBuffers.push_back(mm_tbuf_init());
+	}
+
+	size_t totalReads = 0;
+	size_t mappedReads = 0;
+	for (auto& readsPath : readsPaths)
+	{
+		mm_bseq_file_t* readsFile = mm_bseq_open(readsPath.c_str());
+		if (!readsFile)
+		{
+			throw std::runtime_error("Can't open " + readsPath);
+		}
+
+		while (true)
+		{
+			int numReads = 0;
+			mm_bseq1_t* reads = mm_bseq_read(readsFile, READS_BATCH,
+											 0, &numReads);
+			if (!reads) break;
+
+			std::vector<std::vector<BucketedRecord>> readRecords(numReads);
+			std::vector<size_t> readIds(numReads);
+			for (int i = 0; i < numReads; ++i) readIds[i] = i;
+
+			std::function<void(const size_t&, size_t)> mapRead =
+			[this, reads, &readRecords, &threadBuffers]
+				(const size_t& readId, size_t threadId)
+			{
+				const mm_bseq1_t& read = reads[readId];
+				int numRegs = 0;
+				mm_reg1_t* regs = mm_map(_index, read.l_seq, read.seq, &numRegs,
+										 threadBuffers[threadId], &_mapOpt,
+										 read.name);
+				for (int i = 0; i < numRegs; ++i)
+				{
+					if (!regs[i].p) continue;
+					BucketedRecord rec;
+					this->makeRecord(regs[i], read, rec);
+					readRecords[readId].push_back(std::move(rec));
+				}
+
+				for (int i = 0; i < numRegs; ++i) free(regs[i].p);
+				free(regs);
+			};
+			processInParallelThreaded(readIds, mapRead, _numThreads,
+									  /*progress*/ false);
+
+			//appending in the input order, so the output is deterministic
+			for (int i = 0; i < numReads; ++i)
+			{
+				if (!readRecords[i].empty()) ++mappedReads;
+				for (auto& rec : readRecords[i])
+				{
+					buckets.addRecord(rec.window, rec.data, rec.end);
+				}
+				free(reads[i].seq);
+				free(reads[i].name);
+			}
+			free(reads);
+			totalReads += numReads;
+			Logger::get().debug() << "Mapped " << totalReads << " reads";
+		}
+		mm_bseq_close(readsFile);
+	}
+
+	for (auto buf : threadBuffers) mm_tbuf_destroy(buf);
+
+	buckets.writeIndex(outPath + ".idx", _windows, _index);
+	Logger::get().debug() << "Aligned " << mappedReads << " / " << totalReads
+		<< " reads, " << buckets.numRecords() << " bucketed records, "
+		<< buckets.numSpills() << " spills";
+}
@@ -0,0 +1,110 @@
+//(c) 2020 by Authors
+//This file is a part of Flye program.
+//Released under the BSD license (see LICENSE file)
+
+//In-process read to contig alignment for polishing. Reads are mapped
+//with the bundled minimap2 library in batches, and the resulting
+//alignments are bucketed by contig windows (the same windows that
+//are later used for bubble generation). Buckets are kept in memory
+//and spilled into a single file once the memory budget is exceeded.
+//Each window is then described by a list of (offset, length) segments
+//of the output file, so the downstream pileup can read a window
+//directly, without sorting and indexing the whole alignment.
+//An alignment that spans several windows is stored only once, in the
+//window where it starts. The index keeps the rightmost alignment end
+//of every window, so the reader can find the windows whose alignments
+//reach into the queried region.
+//Records are binary (host byte order, which is little-endian on all
+//supported platforms), so the pileup reads them without any text parsing:
+//	uint32 contig id (order in the contigs file), int32 ref start,
+//	int32 ref end (0-based, half-open),
+//	int32 left clip, int32 right clip (read bases outside the alignment,
+//	in the reference orientation), int32 query length of the unclipped
+//	record, uint16 SAM flag, uint8 mapq, uint8 padding,
+//	uint32 name length, uint32 number of CIGAR operations,
+//	uint32 aligned sequence length,
+//followed by the read name, the CIGAR operations packed as in minimap2
+//(length << 4 | op, uint32 each) and the aligned part of the read
+//on the reference strand.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+#include "minimap.h"
+#include "bseq.h"
+
+
+struct ContigWindow
+{
+	uint32_t ctgId;
+	int32_t start;
+	int32_t end;
+};
+
+class AlignmentBuckets
+{
+public:
+	AlignmentBuckets(const std::string& outPath, size_t memoryBudget);
+	~AlignmentBuckets();
+
+	void addRecord(size_t windowId, const std::string& record,
+				   int32_t recordEnd);
+	void flush();
+	void writeIndex(const std::string& indexPath,
+					const std::vector<ContigWindow>& windows,
+					const mm_idx_t* index);
+
+	size_t numRecords() const {return _numRecords;}
+	size_t numSpills() const {return _numSpills;}
+
+private:
+	struct Segment
+	{
+		uint64_t offset;
+		uint64_t length;
+	};
+
+	FILE* 								_outFile;
+	uint64_t 							_outOffset;
+	size_t 								_memoryBudget;
+	size_t 								_bufferedBytes;
+	size_t 								_numRecords;
+	size_t 								_numSpills;
+	std::vector<std::string> 			_buffers;
+	std::vector<std::vector<Segment>> 	_segments;
+	std::vector<int32_t> 				_maxEnd;
+};
+
+class MinimapAligner
+{
+public:
+	MinimapAligner(const std::string& contigsPath,
+				   const std::string& platform, int numThreads);
+	~MinimapAligner();
+
+	void alignReads(const std::vector<std::string>& readsPaths,
+					const std::string& outPath, int windowSize,
+					size_t memoryBudget);
+
+private:
+	struct BucketedRecord
+	{
+		size_t window;
+		int32_t end;
+		std::string data;
+	};
+
+	void makeWindows(int windowSize);
+	void makeRecord(const mm_reg1_t& reg, const mm_bseq1_t& read,
+					BucketedRecord& record) const;
+
+	mm_idx_t* 							_index;
+	mm_mapopt_t 						_mapOpt;
+	int 								_numThreads;
+	std::vector<ContigWindow> 			_windows;
+	std::vector<size_t> 				_firstWindow;
+};
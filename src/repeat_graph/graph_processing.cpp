@@ -44,11 +44,7 @@ void GraphProcessor::fixChimericJunctions()
 	}
 	for (auto& node : simpleCases)
 	{
-		GraphNode* newNode = _graph.addNode();
-		GraphEdge* cutEdge = node->outEdges.front();
-		newNode->outEdges.push_back(cutEdge);
-		cutEdge->nodeLeft = newNode;
-		node->outEdges.clear();
+		_graph.disconnectLeft(node->outEdges.front());
 	}
 
 	//more common case: 2 in - 2 out
@@ -74,13 +70,8 @@ void GraphProcessor::fixChimericJunctions()
 	for(auto& node : complexCases)
 	{
 		GraphNode* newNode = _graph.addNode();
-		node->inEdges[1]->nodeRight = newNode;
-		node->outEdges[0]->nodeLeft = newNode;
-		newNode->inEdges.push_back(node->inEdges[1]);
-		newNode->outEdges.push_back(node->outEdges[0]);
-
-		node->inEdges.pop_back();
-		node->outEdges.erase(node->outEdges.begin());
+		_graph.relinkRight(node->inEdges[1], newNode);
+		_graph.relinkLeft(node->outEdges[0], newNode);
 	}
 
 	Logger::get().debug() << "Removed " 
@@ -316,12 +307,14 @@ std::vector<UnbranchingPath> GraphProcessor::getEdgesPaths() const
 	return paths;
 }
 
-//Finds unbranching paths
+//Finds unbranching paths. The paths themselves are taken from
+//the graph's incrementally updated index, while the ids
+//and the edge statistics are recomputed on every call
 std::vector<UnbranchingPath> GraphProcessor::getUnbranchingPaths() const
 {
 	std::unordered_map<FastaRecord::Id, size_t> edgeIds;
 	size_t nextEdgeId = 0;
-	auto pathToId = [&edgeIds, &nextEdgeId](GraphPath path)
+	auto pathToId = [&edgeIds, &nextEdgeId](const GraphPath& path)
 	{
 		if (!edgeIds.count(path.front()->edgeId))
 		{
@@ -337,39 +330,9 @@ std::vector<UnbranchingPath> GraphProcessor::getUnbranchingPaths() const
 	};
 	
 	std::vector<UnbranchingPath> unbranchingPaths;
-	std::unordered_set<GraphEdge*> visitedEdges;
-	for (auto edge : _graph.iterEdges())
+	for (const GraphPath* indexedPath : _graph.getUnbranchingPaths())
 	{
-		if (visitedEdges.count(edge)) continue;
-		visitedEdges.insert(edge);
-
-		GraphPath traversed;
-		traversed.push_back(edge);
-		if (!edge->selfComplement)
-		{
-			GraphNode* curNode = edge->nodeLeft;
-			while (!curNode->isBifurcation() &&
-				   !curNode->inEdges.empty() &&
-				   !visitedEdges.count(curNode->inEdges.front()) &&
-				   !curNode->inEdges.front()->selfComplement)
-			{
-				traversed.push_back(curNode->inEdges.front());
-				visitedEdges.insert(traversed.back());
-				curNode = curNode->inEdges.front()->nodeLeft;
-			}
-			std::reverse(traversed.begin(), traversed.end());
-			curNode = edge->nodeRight;
-			while (!curNode->isBifurcation() &&
-				   !curNode->outEdges.empty() &&
-				   !visitedEdges.count(curNode->outEdges.front()) &&
-				   !curNode->outEdges.front()->selfComplement)
-			{
-				traversed.push_back(curNode->outEdges.front());
-				visitedEdges.insert(traversed.back());
-				curNode = curNode->outEdges.front()->nodeRight;
-			}
-		}
-
+		const GraphPath& traversed = *indexedPath;
 		FastaRecord::Id edgeId = pathToId(traversed);
 		bool circular = (traversed.front()->nodeLeft == 
 							traversed.back()->nodeRight) &&
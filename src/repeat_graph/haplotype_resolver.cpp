@@ -1,5 +1,6 @@
 #include "haplotype_resolver.h"
 #include "graph_processing.h"
+#include "../common/parallel.h"
 #include <queue>
 #include <set>
 
@@ -135,6 +136,11 @@ int HaplotypeResolver::findHeterozygousLoops()
 
 	GraphProcessor proc(_graph, _asmSeqs);
 	auto unbranchingPaths = proc.getUnbranchingPaths();
+	std::unordered_map<GraphEdge*, UnbranchingPath*> pathIndex;
+	for (UnbranchingPath& path : unbranchingPaths)
+	{
+		for (GraphEdge* edge : path.path) pathIndex[edge] = &path;
+	}
 
 	std::unordered_set<FastaRecord::Id> toUnroll;
 	std::unordered_set<FastaRecord::Id> toRemove;
@@ -150,14 +156,17 @@ int HaplotypeResolver::findHeterozygousLoops()
 		if (node->inEdges.size() != 2 ||
 			node->outEdges.size() != 2) continue;
 
+		//since the node is a bifurcation, the paths that end (start)
+		//with the other input (output) edge are the entrance (exit)
 		UnbranchingPath* entrancePath = nullptr;
 		UnbranchingPath* exitPath = nullptr;
-		for (auto& cand : unbranchingPaths)
+		for (GraphEdge* edge : node->inEdges)
 		{
-			if (cand.nodeRight() == node &&
-				loop.id != cand.id) entrancePath = &cand;
-			if (cand.nodeLeft() == node &&
-				loop.id != cand.id) exitPath = &cand;
+			if (pathIndex[edge]->id != loop.id) entrancePath = pathIndex[edge];
+		}
+		for (GraphEdge* edge : node->outEdges)
+		{
+			if (pathIndex[edge]->id != loop.id) exitPath = pathIndex[edge];
 		}
 
 		if (entrancePath->isLooped()) continue;
@@ -677,23 +686,15 @@ DnaSequence HaplotypeResolver::pathSequence(GraphPath& path)
 void HaplotypeResolver::separeteAdjacentEdges(GraphEdge* inEdge, GraphEdge* outEdge)
 {
 	GraphNode* newNode = _graph.addNode();
-
-	vecRemove(inEdge->nodeRight->inEdges, inEdge);
-	inEdge->nodeRight = newNode;
-	newNode->inEdges.push_back(inEdge);
-
-	vecRemove(outEdge->nodeLeft->outEdges, outEdge);
-	outEdge->nodeLeft = newNode;
-	newNode->outEdges.push_back(outEdge);
+	_graph.relinkRight(inEdge, newNode);
+	_graph.relinkLeft(outEdge, newNode);
 }
 
 void HaplotypeResolver::separateDistantEdges(GraphEdge* inEdge, GraphEdge* outEdge,
 						  					 EdgeSequence insertSeq, FastaRecord::Id newId)
 {
 	GraphNode* leftNode = _graph.addNode();
-	vecRemove(inEdge->nodeRight->inEdges, inEdge);
-	inEdge->nodeRight = leftNode;
-	leftNode->inEdges.push_back(inEdge);
+	_graph.relinkRight(inEdge, leftNode);
 
 	GraphNode* rightNode = _graph.addNode();
 	GraphEdge* newEdge = _graph.addEdge(GraphEdge(leftNode, rightNode,
@@ -703,9 +704,7 @@ void HaplotypeResolver::separateDistantEdges(GraphEdge* inEdge, GraphEdge* outEd
 							outEdge->meanCoverage) / 2;
 	newEdge->meanCoverage = pathCoverage;
 
-	vecRemove(outEdge->nodeLeft->outEdges, outEdge);
-	outEdge->nodeLeft = rightNode;
-	rightNode->outEdges.push_back(outEdge);
+	_graph.relinkLeft(outEdge, rightNode);
 }
 
 void HaplotypeResolver::resetEdges()
@@ -870,7 +869,7 @@ namespace
 
 	Superbubble isRightSuperbubble(GraphEdge* startEdge, int maxBubbleLen,
 								   const RepeatGraph& graph, 
-								   const std::unordered_set<GraphEdge*> loopedEdges)
+								   const std::unordered_set<GraphEdge*>& loopedEdges)
 	{
 		//Logger::get().debug() << "\t\tSearching for ref. path";
 		auto refPath = anyPath(startEdge, maxBubbleLen, graph);
@@ -890,7 +889,7 @@ namespace
 			if (!endCand->nodeLeft->isBifurcation()) continue;
 			//if (endCand->nodeLeft->inEdges.size() < 2) continue;
 
-			static DijkstraResult distancesFromSource;
+			thread_local DijkstraResult distancesFromSource;
 			getShortestPathsLen(startEdge, endCand, maxBubbleLen, 
 								distancesFromSource);
 			if (distancesFromSource.failure)
@@ -905,7 +904,7 @@ namespace
 					<< " " << edgeDist.second;
 			}*/
 
-			static DijkstraResult distancesFromSink;
+			thread_local DijkstraResult distancesFromSink;
 			getShortestPathsLen(graph.complementEdge(endCand), 
 								graph.complementEdge(startEdge),
 								maxBubbleLen, distancesFromSink);
@@ -986,12 +985,13 @@ int HaplotypeResolver::findSuperbubbles()
 		}
 	}
 
-	int foundNew = 0;
-	std::unordered_set<GraphEdge*> usedEdges;
+	//first, select the bubble start candidates and search for
+	//superbubbles from each of them in parallel. The search only 
+	//reads the graph, so the results do not depend on the order
+	std::vector<GraphEdge*> startCandidates;
 	for (auto& startEdge : _graph.iterEdges())
 	{
 		if (loopedEdges.count(startEdge)) continue;
-		if (usedEdges.count(startEdge)) continue;
 		//if (startEdge->nodeRight->outEdges.size() < 2) continue;
 		//if (!startEdge->nodeRight->isBifurcation()) continue;
 		
@@ -1013,10 +1013,35 @@ int HaplotypeResolver::findSuperbubbles()
 
 		//if (startEdge->nodeRight->inEdges.size() > 1 ||
 		//	startEdge->nodeRight->outEdges.size() < 2) continue;
+		startCandidates.push_back(startEdge);
+	}
 
+	std::vector<size_t> candidateIds(startCandidates.size());
+	for (size_t i = 0; i < candidateIds.size(); ++i) candidateIds[i] = i;
+	std::vector<Superbubble> foundBubbles(startCandidates.size());
+	std::function<void(const size_t&)> searchBubble = 
+	[this, &startCandidates, &foundBubbles, &loopedEdges, MAX_BUBBLE_LEN]
+		(const size_t& candId)
+	{
 		//finding superbubble in one direction
-		auto fwdBubble = isRightSuperbubble(startEdge, MAX_BUBBLE_LEN,
-											_graph, loopedEdges);
+		foundBubbles[candId] = isRightSuperbubble(startCandidates[candId], 
+												  MAX_BUBBLE_LEN, _graph, 
+												  loopedEdges);
+	};
+	processInParallel(candidateIds, searchBubble, 
+					  Parameters::get().numThreads, /*progress*/ false);
+
+	//then, mark the found bubbles sequentially, in the
+	//original edge order. A bubble is skipped if its start
+	//was already used as the end of a previous bubble
+	int foundNew = 0;
+	std::unordered_set<GraphEdge*> usedEdges;
+	for (size_t candId = 0; candId < startCandidates.size(); ++candId)
+	{
+		GraphEdge* startEdge = startCandidates[candId];
+		if (usedEdges.count(startEdge)) continue;
+
+		const Superbubble& fwdBubble = foundBubbles[candId];
 		if (!fwdBubble.end || startEdge == fwdBubble.end ||
 			startEdge == _graph.complementEdge(fwdBubble.end)) continue;
 
@@ -164,6 +164,12 @@ int repeat_main(int argc, char** argv)
 	{
 		kmerSize = Config::get("kmer_size");
 	}
+	if ((size_t)kmerSize > Kmer::MAX_SIZE)
+	{
+		Logger::get().error() << "K-mer size " << kmerSize << " is not supported, "
+			<< "the maximum is " << Kmer::MAX_SIZE;
+		return 1;
+	}
 	Parameters::get().numThreads = numThreads;
 	Parameters::get().kmerSize = kmerSize;
 	Parameters::get().minimumOverlap = minOverlap;
@@ -355,21 +355,17 @@ int MultiplicityInferer::splitNodes()
 
 			for (auto& cl : clusters)
 			{
-				auto switchNode = [](GraphEdge* edge, 
-									 GraphNode* newNode,
-									 bool isInput)
+				auto switchNode = [this](GraphEdge* edge, 
+										 GraphNode* newNode,
+										 bool isInput)
 				{
 					if (!isInput)
 					{
-						vecRemove(edge->nodeLeft->outEdges, edge);
-						edge->nodeLeft = newNode;
-						newNode->outEdges.push_back(edge);
+						_graph.relinkLeft(edge, newNode);
 					}
 					else
 					{
-						vecRemove(edge->nodeRight->inEdges, edge);
-						edge->nodeRight = newNode;
-						newNode->inEdges.push_back(edge);
+						_graph.relinkRight(edge, newNode);
 					}
 
 				};
@@ -566,15 +562,11 @@ void MultiplicityInferer::trimTipsIteration(int& outShort, int& outLong)
 			GraphEdge* targetEdge = path.path.front();
 			GraphEdge* complEdge = _graph.complementEdge(targetEdge);
 
-			vecRemove(targetEdge->nodeLeft->outEdges, targetEdge);
-			targetEdge->nodeLeft = _graph.addNode();
-			targetEdge->nodeLeft->outEdges.push_back(targetEdge);
+			_graph.disconnectLeft(targetEdge);
 
 			//if (targetEdge->selfComplement) continue;
 
-			vecRemove(complEdge->nodeRight->inEdges, complEdge);
-			complEdge->nodeRight = _graph.addNode();
-			complEdge->nodeRight->inEdges.push_back(complEdge);
+			_graph.disconnectRight(complEdge);
 
 
 			if ((bool)Config::get("remove_alt_edges"))
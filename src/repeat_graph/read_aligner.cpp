@@ -11,9 +11,14 @@
 
 namespace
 {
-	struct Chain
+	//chains are stored as a forest of back-pointers: each node 
+	//references the previous alignment of the chain, so extending 
+	//a chain does not require copying it
+	struct ChainNode
 	{
-		std::vector<const EdgeAlignment*> aln;
+		const EdgeAlignment* aln;
+		int32_t prev;
+		int32_t first;
 		int32_t score;
 	};
 }
@@ -29,12 +34,15 @@ std::vector<GraphAlignment>
 	static const int32_t MIN_ALN = Parameters::get().minimumOverlap;
 	static const int32_t MAX_SEP = (int)Config::get("max_separation");
 
-	std::deque<Chain> activeChains;
-	std::deque<Chain> frozenChains;
+	std::vector<ChainNode> nodes;
+	nodes.reserve(ovlps.size());
+	//chains are represented by the indices of their last nodes
+	std::vector<int32_t> activeChains;
+	std::vector<int32_t> frozenChains;
 	for (auto& edgeAlignment : ovlps)
 	{
 		int32_t maxScore = 0;
-		Chain* maxChain = nullptr;
+		int32_t maxChain = -1;
 		int numOutdated = 0;
 
 		bool canExtend = edgeAlignment.overlap.extBegin < MAX_JUMP;
@@ -43,16 +51,17 @@ std::vector<GraphAlignment>
 
 		if (canExtend)
 		{
-			for (auto& chain : activeChains)
+			for (int32_t chainId : activeChains)
 			{
+				const ChainNode& chain = nodes[chainId];
 				const OverlapRange& nextOvlp = edgeAlignment.overlap;
-				const OverlapRange& prevOvlp = chain.aln.back()->overlap;
+				const OverlapRange& prevOvlp = chain.aln->overlap;
 
 				int32_t readDiff = nextOvlp.curBegin - prevOvlp.curEnd;
 				int32_t graphLeftDiff = nextOvlp.extBegin;
 				int32_t graphRightDiff = prevOvlp.extLen - prevOvlp.extEnd;
 
-				if (chain.aln.back()->edge->nodeRight == edgeAlignment.edge->nodeLeft &&
+				if (chain.aln->edge->nodeRight == edgeAlignment.edge->nodeLeft &&
 					MAX_JUMP > readDiff && readDiff > -MAX_READ_OVLP &&
 					graphLeftDiff + graphRightDiff < MAX_JUMP)
 				{
@@ -62,7 +71,7 @@ std::vector<GraphAlignment>
 					if (score > maxScore)
 					{
 						maxScore = score;
-						maxChain = &chain;
+						maxChain = chainId;
 					}
 				}
 
@@ -70,65 +79,65 @@ std::vector<GraphAlignment>
 			}
 		}
 
+		int32_t newNode = nodes.size();
 		//found chain to continue
-		if (maxChain)
+		if (maxChain >= 0)
 		{
-			activeChains.push_back(*maxChain);		//add a copy of the extended chain
-			activeChains.back().aln.push_back(&edgeAlignment);
-			activeChains.back().score = maxScore;
+			//the extended chain remains active, so it could be
+			//extended with the other alignments as well
+			nodes.push_back({&edgeAlignment, maxChain, 
+							 nodes[maxChain].first, maxScore});
+			activeChains.push_back(newNode);
 		}
 		//can't continue, create a new chain
 		else
 		{
+			nodes.push_back({&edgeAlignment, -1, newNode, 
+							 edgeAlignment.overlap.score});
 			if (canBeExtended)
 			{
-				activeChains.push_back({{&edgeAlignment}, 
-										 edgeAlignment.overlap.score});
+				activeChains.push_back(newNode);
 			}
 			else
 			{
-				frozenChains.push_back({{&edgeAlignment}, 
-										 edgeAlignment.overlap.score});
+				frozenChains.push_back(newNode);
 			}
 		}
 
 		//cleaning up if too much outdated chains
 		if (numOutdated > (int)activeChains.size() / 2)
 		{
-			auto itInsert = activeChains.begin();
-			auto itCur = activeChains.begin();
-			while(itCur != activeChains.end())
+			size_t insertIdx = 0;
+			for (size_t i = 0; i < activeChains.size(); ++i)
 			{
 				bool outdated = edgeAlignment.overlap.curBegin - 
-								itCur->aln.back()->overlap.curEnd > MAX_JUMP;
+						nodes[activeChains[i]].aln->overlap.curEnd > MAX_JUMP;
 				if (outdated)
 				{
-					frozenChains.push_back(*itCur);
+					frozenChains.push_back(activeChains[i]);
 				}
 				else
 				{
-					if (itInsert != itCur) *itInsert = *itCur;
-					++itInsert;
+					activeChains[insertIdx++] = activeChains[i];
 				}
-				++itCur;
 			}
-			activeChains.erase(itInsert, activeChains.end());
+			activeChains.resize(insertIdx);
 		}
 	}
 
 	activeChains.insert(activeChains.end(), frozenChains.begin(), 
 						frozenChains.end());	
 	std::sort(activeChains.begin(), activeChains.end(),
-			  [](const Chain& c1, const Chain& c2)
-			  {return c1.score > c2.score;});
+			  [&nodes](int32_t c1, int32_t c2)
+			  {return nodes[c1].score > nodes[c2].score;});
 
 	//greedily choose non-intersecting set of alignments
 	std::vector<GraphAlignment> acceptedAlignments;
-	for (auto& chain : activeChains)
+	for (int32_t chainId : activeChains)
 	{
-		int32_t alnLen = chain.aln.back()->overlap.curEnd - 
-					 	 chain.aln.front()->overlap.curBegin;
-		if (alnLen < MIN_ALN) continue;
+		int32_t curStart = nodes[nodes[chainId].first].aln->overlap.curBegin;
+		int32_t curEnd = nodes[chainId].aln->overlap.curEnd;
+		if (curEnd - curStart < MIN_ALN) continue;
 
 		//check if it overlaps with other accepted chains
 		bool overlaps = false;
@@ -136,8 +145,6 @@ std::vector<GraphAlignment>
 		{
 			int32_t existStart = existAln.front().overlap.curBegin;
 			int32_t existEnd = existAln.back().overlap.curEnd;
-			int32_t curStart = chain.aln.front()->overlap.curBegin;
-			int32_t curEnd = chain.aln.back()->overlap.curEnd;
 
 			int32_t overlapRate = std::min(curEnd, existEnd) - 
 									std::max(curStart, existStart);
@@ -146,7 +153,12 @@ std::vector<GraphAlignment>
 		if (!overlaps) 
 		{
 			acceptedAlignments.emplace_back();
-			for (auto& aln : chain.aln) acceptedAlignments.back().push_back(*aln);
+			for (int32_t node = chainId; node >= 0; node = nodes[node].prev)
+			{
+				acceptedAlignments.back().push_back(*nodes[node].aln);
+			}
+			std::reverse(acceptedAlignments.back().begin(), 
+						 acceptedAlignments.back().end());
 		}
 	}
 
@@ -202,16 +214,19 @@ void ReadAligner::alignReads()
 			allQueries.push_back(read.id);
 		}
 	}
-	std::mutex indexMutex;
-	int numAligned = 0;
-	int alignedInFull = 0;
-	int64_t alignedLength = 0;
+	//each worker thread accumulates its chains in a separate buffer,
+	//the buffers are merged once all reads are processed
+	size_t numThreads = Parameters::get().numThreads;
+	std::vector<std::vector<GraphAlignment>> threadAlignments(numThreads);
+	std::atomic<int> numAligned(0);
+	std::atomic<int> alignedInFull(0);
+	std::atomic<int64_t> alignedLength(0);
 	OvlpDivStats divergenceStats;
 
-	std::function<void(const FastaRecord::Id&)> alignRead = 
-	[this, &indexMutex, &numAligned, &readsOverlaps,
+	std::function<void(const FastaRecord::Id&, size_t)> alignRead = 
+	[this, &threadAlignments, &numAligned, &readsOverlaps,
 		&idToSegment, &alignedLength, &alignedInFull, &divergenceStats] 
-	(const FastaRecord::Id& seqId)
+	(const FastaRecord::Id& seqId, size_t threadId)
 	{
 		auto overlaps = readsOverlaps.quickSeqOverlaps(seqId);
 		std::vector<EdgeAlignment> alignments;
@@ -261,28 +276,33 @@ void ReadAligner::alignReads()
 
 		if (goodChains.empty()) return;
 
-		/////synchronized part
-		indexMutex.lock();
 		++numAligned;
 		if (goodChains.size() == 1) ++alignedInFull;
+		auto& outAlignments = threadAlignments[threadId];
 		for (auto& chain : goodChains) 
 		{
 			chain.shrink_to_fit();
-			_readAlignments.push_back(chain);
 			alignedLength += chain.back().overlap.curEnd - 
 							 chain.front().overlap.curBegin;
+			outAlignments.push_back(std::move(chain));
 		}
 		for (auto& chain : complChains)
 		{
 			chain.shrink_to_fit();
-			_readAlignments.push_back(chain);
+			outAlignments.push_back(std::move(chain));
 		}
-		indexMutex.unlock();
-		/////
 	};
 
-	processInParallel(allQueries, alignRead, 
-					  Parameters::get().numThreads, true);
+	processInParallelThreaded(allQueries, alignRead, numThreads, true);
+
+	size_t totalChains = _readAlignments.size();
+	for (auto& buffer : threadAlignments) totalChains += buffer.size();
+	_readAlignments.reserve(totalChains);
+	for (auto& buffer : threadAlignments)
+	{
+		for (auto& chain : buffer) _readAlignments.push_back(std::move(chain));
+		buffer = std::vector<GraphAlignment>();
+	}
 
 	Logger::get().debug() << "Total reads : " << allQueries.size();
 	Logger::get().debug() << "Read with aligned parts : " << numAligned;
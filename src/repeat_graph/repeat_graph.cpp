@@ -98,14 +98,21 @@ void RepeatGraph::build()
 								  /*partition bad map*/ true,
 								  (bool)Config::get("hpc_scoring_on"));
 
-	OverlapContainer asmOverlaps(asmOverlapper, _asmSeqs);
-	asmOverlaps.findAllOverlaps();
-	asmOverlaps.buildIntervalTree();
-	asmOverlaps.overlapDivergenceStats();
-
-	this->getGluepoints(asmOverlaps);
-	this->collapseTandems();
-	this->initializeEdges(asmOverlaps);
+	{
+		OverlapContainer asmOverlaps(asmOverlapper, _asmSeqs);
+		asmOverlaps.findAllOverlaps();
+		asmOverlaps.buildIntervalTree();
+		asmOverlaps.overlapDivergenceStats();
+
+		this->getGluepoints(asmOverlaps);
+		this->collapseTandems();
+		this->initializeEdges(asmOverlaps);
+	}
+	//overlaps with the stored k-mer matches are no longer needed
+	Logger::get().debug() << "K-mer match arena: " 
+		<< MatchArena::get().allocatedBytes() / 1024 / 1024 << " Mb";
+	MatchArena::get().release();
+
 	GraphProcessor proc(*this, _asmSeqs);
 	proc.simplify();
 	this->logEdges();
@@ -1057,6 +1064,126 @@ void RepeatGraph::logEdges()
 	Logger::get().debug() << "Total edges: " << _nextEdgeId / 2;
 }
 
+//drops the indexed path that contains the given edge. All its
+//edges will be re-traversed during the next index update
+void RepeatGraph::invalidatePath(GraphEdge* edge)
+{
+	auto itPath = _edgeToPath.find(edge);
+	if (itPath == _edgeToPath.end())
+	{
+		_unindexedEdges.insert(edge);
+		return;
+	}
+
+	size_t pathId = itPath->second;
+	for (GraphEdge* pathEdge : _indexedPaths[pathId])
+	{
+		_edgeToPath.erase(pathEdge);
+		_unindexedEdges.insert(pathEdge);
+	}
+	_indexedPaths[pathId].clear();
+	_pathStartEdges[pathId] = nullptr;
+	_freePathSlots.push_back(pathId);
+}
+
+//invalidates all paths that pass through the node
+void RepeatGraph::invalidatePaths(GraphNode* node)
+{
+	for (GraphEdge* edge : node->inEdges) this->invalidatePath(edge);
+	for (GraphEdge* edge : node->outEdges) this->invalidatePath(edge);
+}
+
+//traverses unbranching paths starting from the edges that are
+//not currently indexed. The traversal is the same as if
+//it was done for the whole graph: edges are processed in 
+//the order of their ids, and the indexed edges are treated as visited
+void RepeatGraph::updatePathIndex()
+{
+	if (_unindexedEdges.empty()) return;
+
+	std::vector<GraphEdge*> startEdges;
+	for (GraphEdge* edge : _unindexedEdges)
+	{
+		//skipping removed edges
+		auto itEdge = _idToEdge.find(edge->edgeId);
+		if (itEdge != _idToEdge.end() && itEdge->second == edge)
+		{
+			startEdges.push_back(edge);
+		}
+	}
+	_unindexedEdges.clear();
+	std::sort(startEdges.begin(), startEdges.end(), CmpId());
+
+	for (GraphEdge* edge : startEdges)
+	{
+		if (_edgeToPath.count(edge)) continue;
+
+		size_t pathId = _indexedPaths.size();
+		if (!_freePathSlots.empty())
+		{
+			pathId = _freePathSlots.back();
+			_freePathSlots.pop_back();
+		}
+		else
+		{
+			_indexedPaths.emplace_back();
+			_pathStartEdges.push_back(nullptr);
+		}
+		_edgeToPath[edge] = pathId;
+
+		GraphPath traversed;
+		traversed.push_back(edge);
+		if (!edge->selfComplement)
+		{
+			GraphNode* curNode = edge->nodeLeft;
+			while (!curNode->isBifurcation() &&
+				   !curNode->inEdges.empty() &&
+				   !_edgeToPath.count(curNode->inEdges.front()) &&
+				   !curNode->inEdges.front()->selfComplement)
+			{
+				traversed.push_back(curNode->inEdges.front());
+				_edgeToPath[traversed.back()] = pathId;
+				curNode = curNode->inEdges.front()->nodeLeft;
+			}
+			std::reverse(traversed.begin(), traversed.end());
+			curNode = edge->nodeRight;
+			while (!curNode->isBifurcation() &&
+				   !curNode->outEdges.empty() &&
+				   !_edgeToPath.count(curNode->outEdges.front()) &&
+				   !curNode->outEdges.front()->selfComplement)
+			{
+				traversed.push_back(curNode->outEdges.front());
+				_edgeToPath[traversed.back()] = pathId;
+				curNode = curNode->outEdges.front()->nodeRight;
+			}
+		}
+		traversed.shrink_to_fit();
+		_indexedPaths[pathId] = std::move(traversed);
+		_pathStartEdges[pathId] = edge;
+	}
+}
+
+std::vector<const GraphPath*> RepeatGraph::getUnbranchingPaths()
+{
+	this->updatePathIndex();
+
+	std::vector<size_t> pathIds;
+	pathIds.reserve(_indexedPaths.size());
+	for (size_t i = 0; i < _indexedPaths.size(); ++i)
+	{
+		if (_pathStartEdges[i]) pathIds.push_back(i);
+	}
+	std::sort(pathIds.begin(), pathIds.end(),
+			  [this](size_t p1, size_t p2)
+			  {return _pathStartEdges[p1]->edgeId < 
+			  		  _pathStartEdges[p2]->edgeId;});
+
+	std::vector<const GraphPath*> paths;
+	paths.reserve(pathIds.size());
+	for (size_t pathId : pathIds) paths.push_back(&_indexedPaths[pathId]);
+	return paths;
+}
+
 GraphPath RepeatGraph::complementPath(const GraphPath& path) const
 {
 	if (path.empty()) return {};
@@ -303,6 +303,8 @@ public:
 		{
 			_idToEdge[newEdge->edgeId.rc()] = newEdge;
 		}
+		this->invalidatePaths(newEdge->nodeLeft);
+		this->invalidatePaths(newEdge->nodeRight);
 		return newEdge;
 	}
 	/*bool hasEdge(GraphEdge* edge)
@@ -333,6 +335,8 @@ public:
 
 	void removeEdge(GraphEdge* edge)
 	{
+		this->invalidatePaths(edge->nodeLeft);
+		this->invalidatePaths(edge->nodeRight);
 		vecRemove(edge->nodeRight->inEdges, edge);
 		vecRemove(edge->nodeLeft->outEdges, edge);
 		_sortedEdges.erase(edge);
@@ -343,6 +347,10 @@ public:
 
 	void removeNode(GraphNode* node)
 	{
+		this->invalidatePaths(node);
+		for (auto& edge : node->outEdges) this->invalidatePaths(edge->nodeRight);
+		for (auto& edge : node->inEdges) this->invalidatePaths(edge->nodeLeft);
+
 		std::unordered_set<GraphEdge*> toRemove;
 		for (auto& edge : node->outEdges) 
 		{
@@ -380,22 +388,45 @@ public:
 							 	 int32_t start, int32_t length,
 							 	 const std::string& description);
 
-	void disconnectRight(GraphEdge* edge)
+	//moves the right end of the edge to another node
+	void relinkRight(GraphEdge* edge, GraphNode* newNode)
 	{
-		GraphNode* newNode = this->addNode();
+		this->invalidatePaths(edge->nodeRight);
 		vecRemove(edge->nodeRight->inEdges, edge);
 		edge->nodeRight = newNode;
 		edge->nodeRight->inEdges.push_back(edge);
-	};
+		this->invalidatePaths(newNode);
+	}
 
-	void disconnectLeft(GraphEdge* edge)
+	//moves the left end of the edge to another node
+	void relinkLeft(GraphEdge* edge, GraphNode* newNode)
 	{
-		GraphNode* newNode = this->addNode();
+		this->invalidatePaths(edge->nodeLeft);
 		vecRemove(edge->nodeLeft->outEdges, edge);
 		edge->nodeLeft = newNode;
 		edge->nodeLeft->outEdges.push_back(edge);
+		this->invalidatePaths(newNode);
+	}
+
+	void disconnectRight(GraphEdge* edge)
+	{
+		this->relinkRight(edge, this->addNode());
+	};
+
+	void disconnectLeft(GraphEdge* edge)
+	{
+		this->relinkLeft(edge, this->addNode());
 	};
 
+	//Returns unbranching paths of the current graph, ordered by 
+	//their smallest edge (circular paths end with that edge). 
+	//The index is maintained incrementally: graph modifications
+	//only invalidate the paths that pass through the affected nodes,
+	//and only those are traversed again on the next call.
+	//All modifications of the graph topology should go through the 
+	//methods above, so that the index stays consistent
+	std::vector<const GraphPath*> getUnbranchingPaths();
+
 	void linkEdges(GraphEdge* leftEdge, GraphEdge* rightEdge)
 	{
 		if (leftEdge->rightLink || rightEdge->leftLink)
@@ -438,6 +469,10 @@ private:
 		int32_t end;
 	};
 
+	void invalidatePaths(GraphNode* node);
+	void invalidatePath(GraphEdge* edge);
+	void updatePathIndex();
+
 	void getGluepoints(OverlapContainer& ovlps);
 	void initializeEdges(const OverlapContainer& asmOverlaps);
 	void collapseTandems();
@@ -462,4 +497,11 @@ private:
 		{return e1->edgeId < e2->edgeId;}
 	};
 	std::set<GraphEdge*, CmpId> _sortedEdges;
+
+	//unbranching paths index (see getUnbranchingPaths)
+	std::vector<GraphPath>  _indexedPaths;
+	std::vector<GraphEdge*> _pathStartEdges;
+	std::vector<size_t>		_freePathSlots;
+	std::unordered_map<GraphEdge*, size_t> _edgeToPath;
+	std::unordered_set<GraphEdge*> _unindexedEdges;
 };
@@ -1055,9 +1055,7 @@ void RepeatResolver::separatePath(const GraphPath& graphPath,
 {
 	//first edge
 	GraphNode* leftNode = _graph.addNode();
-	vecRemove(graphPath.front()->nodeRight->inEdges, graphPath.front());
-	graphPath.front()->nodeRight = leftNode;
-	leftNode->inEdges.push_back(graphPath.front());
+	_graph.relinkRight(graphPath.front(), leftNode);
 	int32_t pathCoverage = (graphPath.front()->meanCoverage +
 						    graphPath.back()->meanCoverage) / 2;
 
@@ -1080,8 +1078,6 @@ void RepeatResolver::separatePath(const GraphPath& graphPath,
 	}
 
 	//last edge
-	vecRemove(graphPath.back()->nodeLeft->outEdges, graphPath.back());
-	graphPath.back()->nodeLeft = rightNode;
-	rightNode->outEdges.push_back(graphPath.back());
+	_graph.relinkLeft(graphPath.back(), rightNode);
 }
 
@@ -13,10 +13,19 @@
 
 static_assert(sizeof(size_t) == 8, "32-bit architectures are not supported");
 
+//K-mers are packed into a single integer, 2 bits per nucleotide.
+//The default 64-bit representation supports k up to 31. Building with
+//FLYE_KMER128 (make KMER128=1) switches to 128-bit k-mers (k up to 63),
+//which doubles the memory taken by the k-mer keys.
 class Kmer
 {
 public:
+#ifdef FLYE_KMER128
+	typedef unsigned __int128 KmerRepr;
+#else
 	typedef size_t KmerRepr;
+#endif
+	static const size_t MAX_SIZE = sizeof(KmerRepr) * 4 - 1;
 
 	explicit Kmer(KmerRepr repr=0): _representation(repr) {}
 
@@ -36,19 +45,10 @@ public:
 		}
 	}
 
-	Kmer reverseComplement()
+	Kmer reverseComplement() const
 	{
-		KmerRepr tmpRepr = _representation;
-		Kmer newKmer;
-
-		for (unsigned int i = 0; i < Parameters::get().kmerSize; ++i)
-		{
-			newKmer._representation <<= 2;
-			newKmer._representation += ~tmpRepr & 3;
-			tmpRepr >>= 2;
-		}
-
-		return newKmer;
+		return Kmer(reverseComplementRepr(_representation, 
+										  Parameters::get().kmerSize));
 	}
 
 	bool standardForm()
@@ -64,12 +64,14 @@ public:
 
 	void appendRight(DnaSequence::NuclType dnaSymbol)
 	{
-		_representation <<= 2;
-		_representation += dnaSymbol;
+		this->appendRight(dnaSymbol, kmerMask(Parameters::get().kmerSize));
+	}
 
-		KmerRepr kmerSize = Parameters::get().kmerSize;
-		KmerRepr kmerMask = ((KmerRepr)1 << kmerSize * 2) - 1;
-		_representation &= kmerMask;
+	//same as above, but with the mask for the current k-mer
+	//size precomputed by the caller (e.g. k-mer iterators)
+	void appendRight(DnaSequence::NuclType dnaSymbol, KmerRepr mask)
+	{
+		_representation = ((_representation << 2) + dnaSymbol) & mask;
 	}
 
 	void appendLeft(DnaSequence::NuclType dnaSymbol)
@@ -78,9 +80,27 @@ public:
 
 		KmerRepr kmerSize = Parameters::get().kmerSize;
 		KmerRepr shift = kmerSize * 2 - 2;
-		_representation += dnaSymbol << shift;
+		_representation += (KmerRepr)dnaSymbol << shift;
+	}
+
+	static KmerRepr kmerMask(size_t kmerSize)
+	{
+		return ((KmerRepr)1 << kmerSize * 2) - 1;
 	}
 
+	//Branch-free reverse complement: the nucleotides are complemented
+	//by inverting the bits, then the 2-bit groups are reversed
+	//within each 64-bit word, and the words are swapped
+	static KmerRepr reverseComplementRepr(KmerRepr repr, size_t kmerSize)
+	{
+	#ifdef FLYE_KMER128
+		KmerRepr rev = ((KmerRepr)reverseWord(~(uint64_t)repr) << 64) |
+					   reverseWord(~(uint64_t)(repr >> 64));
+		return rev >> (128 - kmerSize * 2);
+	#else
+		return reverseWord(~repr) >> (64 - kmerSize * 2);
+	#endif
+	}
 
 	bool operator == (const Kmer& other) const
 		{return this->_representation == other._representation;}
@@ -90,7 +110,12 @@ public:
 
 	size_t hash() const
 	{
+	#ifdef FLYE_KMER128
+		size_t x = (uint64_t)_representation ^ 
+				   (uint64_t)(_representation >> 64) * 0xC2B2AE3D27D4EB4FULL;
+	#else
 		size_t x = _representation;
+	#endif
 		size_t z = (x += 0x9E3779B97F4A7C15ULL);
 		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
 		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
@@ -102,9 +127,17 @@ public:
 		return _representation < other._representation;
 	}
 
-	size_t numRepr() {return _representation;}
+	KmerRepr numRepr() const {return _representation;}
 
 private:
+	//reverses the order of 2-bit groups in a word
+	static uint64_t reverseWord(uint64_t x)
+	{
+		x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+		x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+		return __builtin_bswap64(x);
+	}
+
 	KmerRepr _representation;
 };
 
@@ -135,12 +168,14 @@ public:
 
 	KmerIterator(const DnaSequence* readSeq, size_t position):
 		_readSeq(readSeq),
-		_position(position)
+		_position(position),
+		_kmerSize(Parameters::get().kmerSize),
+		_kmerMask(Kmer::kmerMask(_kmerSize))
 	{
-		if (position != readSeq->length() - Parameters::get().kmerSize)
+		if (position != readSeq->length() - _kmerSize)
 		{
 			//_kmer = Kmer(readSeq->substr(0, Parameters::get().kmerSize));
-			_kmer = Kmer(*readSeq, 0, Parameters::get().kmerSize);
+			_kmer = Kmer(*readSeq, 0, _kmerSize);
 		}
 	}
 
@@ -161,8 +196,8 @@ public:
 
 	KmerIterator& operator++()
 	{
-		size_t appendPos = _position + Parameters::get().kmerSize;
-		_kmer.appendRight(_readSeq->atRaw(appendPos));
+		size_t appendPos = _position + _kmerSize;
+		_kmer.appendRight(_readSeq->atRaw(appendPos), _kmerMask);
 		++_position;
 		return *this;
 	}
@@ -170,6 +205,8 @@ public:
 protected:
 	const DnaSequence* _readSeq;
 	size_t 	_position;
+	size_t 	_kmerSize;
+	Kmer::KmerRepr _kmerMask;
 	Kmer 	_kmer;
 };
 
@@ -260,3 +297,100 @@ inline std::vector<KmerPosition> yieldMinimizers(const DnaSequence& sequence, in
 	//Logger::get().debug() << _seqContainer.seqLen(seqId) << " " << minimizers.size();
 	return minimizers;
 }
+
+//Open syncmers: a k-mer is selected if the minimal s-mer within it
+//is located in the middle. Unlike minimizers, the selection depends only
+//on the k-mer itself, so the same k-mers are selected in every read
+//that contains them, and the gaps between the selected k-mers are
+//more uniform. Canonical s-mers are used, and both middle positions
+//are accepted, which makes the selection strand-independent.
+//The expected density is 1 / (k - s + 1)
+inline std::vector<KmerPosition> yieldSyncmers(const DnaSequence& sequence, int smerSize)
+{
+	const int kmerSize = Parameters::get().kmerSize;
+	if (smerSize < 1 || smerSize > kmerSize || smerSize > 31) 
+	{
+		throw std::runtime_error("wrong syncmer s-mer length");
+	}
+
+	std::vector<KmerPosition> syncmers;
+	if (sequence.length() < (size_t)kmerSize) return syncmers;
+
+	//hashes of the canonical s-mers
+	thread_local std::vector<size_t> smerHashes;
+	smerHashes.clear();
+	const size_t smerMask = (1ULL << smerSize * 2) - 1;
+	const size_t revShift = smerSize * 2 - 2;
+	size_t fwdSmer = 0;
+	size_t revSmer = 0;
+	for (size_t i = 0; i < sequence.length(); ++i)
+	{
+		auto nucl = sequence.atRaw(i);
+		fwdSmer = ((fwdSmer << 2) + nucl) & smerMask;
+		revSmer = (revSmer >> 2) + ((3 - nucl) << revShift);
+		if (i + 1 < (size_t)smerSize) continue;
+
+		size_t z = std::min(fwdSmer, revSmer) + 0x9E3779B97F4A7C15ULL;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		smerHashes.push_back(z ^ (z >> 31));
+	}
+
+	const int numSmers = kmerSize - smerSize + 1;
+	const int midLeft = (kmerSize - smerSize) / 2;
+	const int midRight = kmerSize - smerSize - midLeft;
+	syncmers.reserve(sequence.length() / numSmers * 1.5);
+	for (auto kmerPos : IterKmers(sequence))
+	{
+		int minPos = 0;
+		for (int i = 1; i < numSmers; ++i)
+		{
+			if (smerHashes[kmerPos.position + i] < 
+				smerHashes[kmerPos.position + minPos]) minPos = i;
+		}
+		if (minPos == midLeft || minPos == midRight)
+		{
+			syncmers.push_back(kmerPos);
+		}
+	}
+
+	return syncmers;
+}
+
+//Homopolymer-compressed seeding. The seeds (k-mers, minimizers or syncmers,
+//as given by yieldSeeds) are extracted from the homopolymer-compressed
+//sequence, and their positions are mapped back to the raw sequence. The raw
+//span of a compressed k-mer is k bases or longer, so the k-mer is placed in
+//the middle of its raw span. This keeps the positions consistent between
+//the two strands (up to one base) with the regular k-mer coordinate conversion
+template <class SeedFunc>
+std::vector<KmerPosition> yieldHpcSeeds(const DnaSequence& sequence, 
+										SeedFunc yieldSeeds)
+{
+	const int32_t kmerSize = Parameters::get().kmerSize;
+
+	//compressed sequence and the raw positions of the homopolymer runs
+	thread_local std::vector<int32_t> rawPositions;
+	rawPositions.clear();
+	std::string hpcString;
+	hpcString.reserve(sequence.length());
+	for (size_t i = 0; i < sequence.length(); ++i)
+	{
+		char nucl = sequence.at(i);
+		if (hpcString.empty() || hpcString.back() != nucl)
+		{
+			hpcString.push_back(nucl);
+			rawPositions.push_back(i);
+		}
+	}
+	rawPositions.push_back(sequence.length());
+
+	std::vector<KmerPosition> seeds = yieldSeeds(DnaSequence(hpcString));
+	for (auto& kmerPos : seeds)
+	{
+		int32_t rawStart = rawPositions[kmerPos.position];
+		int32_t rawEnd = rawPositions[kmerPos.position + kmerSize];
+		kmerPos.position = rawStart + (rawEnd - rawStart - kmerSize) / 2;
+	}
+	return seeds;
+}
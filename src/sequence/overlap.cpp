@@ -25,6 +25,55 @@
 #include "../common/bfcontainer.h"
 
 
+namespace
+{
+	//the current arena block of each thread. Blocks that were
+	//allocated before the last release() are not used anymore
+	struct ThreadMatchBlock
+	{
+		ThreadMatchBlock(): next(nullptr), left(0), generation(0) {}
+
+		MatchPair* next;
+		size_t left;
+		size_t generation;
+	};
+	thread_local ThreadMatchBlock threadMatchBlock;
+}
+
+MatchPair* MatchArena::allocate(size_t size)
+{
+	const size_t BLOCK_SIZE = 1 << 16;
+
+	ThreadMatchBlock& block = threadMatchBlock;
+	if (block.generation != _generation || block.left < size)
+	{
+		const size_t blockSize = std::max(BLOCK_SIZE, size);
+		MatchPair* newBlock = new MatchPair[blockSize];
+		{
+			std::lock_guard<std::mutex> lock(_blocksLock);
+			_blocks.emplace_back(newBlock);
+		}
+		_allocatedBytes += blockSize * sizeof(MatchPair);
+
+		block.next = newBlock;
+		block.left = blockSize;
+		block.generation = _generation;
+	}
+
+	MatchPair* data = block.next;
+	block.next += size;
+	block.left -= size;
+	return data;
+}
+
+void MatchArena::release()
+{
+	std::lock_guard<std::mutex> lock(_blocksLock);
+	std::vector<std::unique_ptr<MatchPair[]>>().swap(_blocks);
+	_allocatedBytes = 0;
+	++_generation;
+}
+
 //Check if it is a proper overlap
 bool OverlapDetector::overlapTest(const OverlapRange& ovlp,
 								  bool forceLocal) const
@@ -81,6 +130,139 @@ namespace
 		FastaRecord::Id extId;
 	};
 
+	//One pass of the LSD radix sort by the ext sequence id (stable)
+	template <class It>
+	void radixPass(It begin, It end, int shift, KmerMatch* out)
+	{
+		const size_t NUM_BUCKETS = 1 << 11;
+		size_t offsets[NUM_BUCKETS] = {0};
+		for (It it = begin; it != end; ++it)
+		{
+			++offsets[(it->extId.rawId() >> shift) & (NUM_BUCKETS - 1)];
+		}
+		size_t total = 0;
+		for (size_t i = 0; i < NUM_BUCKETS; ++i)
+		{
+			size_t count = offsets[i];
+			offsets[i] = total;
+			total += count;
+		}
+		for (It it = begin; it != end; ++it)
+		{
+			out[offsets[(it->extId.rawId() >> shift) & (NUM_BUCKETS - 1)]++] = *it;
+		}
+	}
+
+	//Groups the matches by ext sequence id (which are dense integers) using
+	//radix sort with 11-bit digits, and only as many passes as the largest id
+	//requires. Matches are generated in the order of the current sequence
+	//positions, and the sort is stable - so each group remains sorted by curPos
+	void groupMatches(BFContainer<KmerMatch>& matches, 
+					  std::vector<KmerMatch>& outGrouped,
+					  std::vector<KmerMatch>& buffer)
+	{
+		const int DIGIT_BITS = 11;
+		uint32_t maxId = 0;
+		for (auto it = matches.begin(); it != matches.end(); ++it)
+		{
+			maxId = std::max(maxId, it->extId.rawId());
+		}
+		int numPasses = 1;
+		while (numPasses * DIGIT_BITS < 32 && 
+			   (maxId >> (numPasses * DIGIT_BITS)) > 0) ++numPasses;
+
+		//passes alternate between the buffers, so the last one ends in the output
+		outGrouped.resize(matches.size());
+		if (numPasses > 1) buffer.resize(matches.size());
+		auto passOutput = [&outGrouped, &buffer, numPasses](int pass)
+		{
+			return (numPasses - pass) % 2 ? outGrouped.data() : buffer.data();
+		};
+
+		radixPass(matches.begin(), matches.end(), 0, passOutput(0));
+		for (int pass = 1; pass < numPasses; ++pass)
+		{
+			KmerMatch* input = passOutput(pass - 1);
+			radixPass(input, input + matches.size(), pass * DIGIT_BITS, 
+					  passOutput(pass));
+		}
+	}
+
+	//Diagonal band pre-filter. Matches are binned by the diagonal 
+	//(curPos - extPos) into bands of the given width, and the candidate
+	//is accepted if some window of three adjacent bands has enough
+	//matches that span at least minSpan. Only the matches from the 
+	//accepted windows (plus one band on each side) are kept, in place,
+	//preserving the order. Returns the new number of matches (0 if
+	//the candidate is rejected)
+	size_t filterDiagonalBands(KmerMatch* matches, size_t numMatches,
+							   int32_t bandWidth, int32_t minSpan, 
+							   size_t minMatches)
+	{
+		struct Band
+		{
+			size_t count;
+			int32_t minCur;
+			int32_t maxCur;
+		};
+		const int WINDOW = 3;
+
+		int32_t minDiag = std::numeric_limits<int32_t>::max();
+		int32_t maxDiag = std::numeric_limits<int32_t>::min();
+		for (size_t i = 0; i < numMatches; ++i)
+		{
+			minDiag = std::min(minDiag, matches[i].curPos - matches[i].extPos);
+			maxDiag = std::max(maxDiag, matches[i].curPos - matches[i].extPos);
+		}
+		const int32_t numBands = (maxDiag - minDiag) / bandWidth + 1;
+		auto bandId = [minDiag, bandWidth](const KmerMatch& match)
+		{
+			return (match.curPos - match.extPos - minDiag) / bandWidth;
+		};
+
+		thread_local std::vector<Band> bands;
+		thread_local std::vector<char> supported;
+		bands.assign(numBands, {0, std::numeric_limits<int32_t>::max(),
+								std::numeric_limits<int32_t>::min()});
+		supported.assign(numBands, false);
+		for (size_t i = 0; i < numMatches; ++i)
+		{
+			Band& band = bands[bandId(matches[i])];
+			++band.count;
+			band.minCur = std::min(band.minCur, matches[i].curPos);
+			band.maxCur = std::max(band.maxCur, matches[i].curPos);
+		}
+
+		bool anySupported = false;
+		for (int32_t wndStart = 0; 
+			 wndStart < std::max(1, numBands - WINDOW + 1); ++wndStart)
+		{
+			const int32_t wndEnd = std::min(numBands, wndStart + WINDOW);
+			Band window = {0, std::numeric_limits<int32_t>::max(),
+						   std::numeric_limits<int32_t>::min()};
+			for (int32_t b = wndStart; b < wndEnd; ++b)
+			{
+				window.count += bands[b].count;
+				window.minCur = std::min(window.minCur, bands[b].minCur);
+				window.maxCur = std::max(window.maxCur, bands[b].maxCur);
+			}
+			if (window.count < minMatches || 
+				window.maxCur - window.minCur < minSpan) continue;
+
+			anySupported = true;
+			for (int32_t b = std::max(0, wndStart - 1); 
+				 b < std::min(numBands, wndEnd + 1); ++b) supported[b] = true;
+		}
+		if (!anySupported) return 0;
+
+		size_t numKept = 0;
+		for (size_t i = 0; i < numMatches; ++i)
+		{
+			if (supported[bandId(matches[i])]) matches[numKept++] = matches[i];
+		}
+		return numKept;
+	}
+
 	template <class T>
 	void shrinkAndClear(std::vector<T>& vec, float rate)
 	{
@@ -100,7 +282,8 @@ std::vector<OverlapRange>
 OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec, 
 								bool forceLocal,
 								OvlpDivStats& divStats,
-								int maxOverlaps) const
+								int maxOverlaps,
+								FastaRecord::Id maxExtId) const
 {
 	//static std::ofstream fout("../kmers.txt");
 	
@@ -112,6 +295,7 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 	static const float LG_GAP = (float)Config::get("chain_large_gap_penalty");
 	static const float SM_GAP = (float)Config::get("chain_small_gap_penalty");
 	static const int GAP_JUMP_THLD = (int)Config::get("chain_gap_jump_threshold");
+	static const bool DIAGONAL_FILTER = (bool)Config::get("diagonal_band_filter");
 
 	//outSuggestChimeric = false;
 	int32_t curLen = fastaRec.sequence.length();
@@ -120,9 +304,11 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 	//cache memory-intensive containers as
 	//many parallel memory allocations slow us down significantly
 	//thread_local std::vector<KmerMatch> vecMatches;
-	thread_local std::vector<KmerMatch> matchesList;
+	thread_local std::vector<KmerMatch> groupedMatches;
+	thread_local std::vector<KmerMatch> radixBuffer;
 	thread_local std::vector<int32_t> scoreTable;
 	thread_local std::vector<int32_t> backtrackTable;
+	thread_local std::vector<VertexIndex::ReadPosition> kmerHits;
 
 	static ChunkPool<KmerMatch> sharedChunkPool;	//shared accoress threads
 	BFContainer<KmerMatch> vecMatches(sharedChunkPool);
@@ -167,7 +353,8 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 	if (++prevCleanup > 50)
 	{
 		prevCleanup = 0;
-		shrinkAndClear(matchesList, 2);
+		shrinkAndClear(groupedMatches, 2);
+		shrinkAndClear(radixBuffer, 2);
 		shrinkAndClear(scoreTable, 2);
 		shrinkAndClear(backtrackTable, 2);
 	}
@@ -175,35 +362,52 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 						(std::chrono::system_clock::now() - timeStart).count();
 	timeStart = std::chrono::system_clock::now();
 
-	for (const auto& curKmerPos : IterKmers(fastaRec.sequence))
+	//with homopolymer-compressed index, the query k-mers
+	//should be compressed in the same way
+	std::vector<KmerPosition> hpcKmers;
+	if (_vertexIndex.hpcSeeds())
+	{
+		hpcKmers = yieldHpcSeeds(fastaRec.sequence, [](const DnaSequence& seq)
+								 {return yieldMinimizers(seq, /*all*/ 1);});
+	}
+	auto queryKmer = [&](const KmerPosition& curKmerPos)
 	{
 		if (_vertexIndex.isRepetitive(curKmerPos.kmer))
 		{
 			curFilteredPos.push_back(curKmerPos.position);
-			continue;
+			return;
 		}
-		if (!_vertexIndex.kmerFreq(curKmerPos.kmer)) continue;
+		if (!_vertexIndex.decodeKmerPos(curKmerPos.kmer, kmerHits)) return;
 
 		//FastaRecord::Id prevSeqId = FastaRecord::ID_NONE;
-		for (const auto& extReadPos : _vertexIndex.iterKmerPos(curKmerPos.kmer))
+		for (const auto& extReadPos : kmerHits)
 		{
 			//no trivial matches
 			if ((extReadPos.readId == fastaRec.id &&
 				extReadPos.position == curKmerPos.position)) continue;
 
+			//half-matrix mode: both strands of the ext sequence
+			//are compared by the forward strand id
+			if ((extReadPos.readId.rawId() & ~1U) > maxExtId.rawId()) continue;
+
 			vecMatches.emplace_back(curKmerPos.position, 
 									extReadPos.position,
 									extReadPos.readId);
 		}
+	};
+	if (!_vertexIndex.hpcSeeds())
+	{
+		for (const auto& curKmerPos : IterKmers(fastaRec.sequence)) queryKmer(curKmerPos);
+	}
+	else
+	{
+		for (const auto& curKmerPos : hpcKmers) queryKmer(curKmerPos);
 	}
 	timeKmerIndexFirst += std::chrono::duration_cast<std::chrono::duration<float>>
 							(std::chrono::system_clock::now() - timeStart).count();
 	timeStart = std::chrono::system_clock::now();
 
-	std::sort(vecMatches.begin(), vecMatches.end(),
-			  [](const KmerMatch& k1, const KmerMatch& k2)
-			  {return k1.extId != k2.extId ? k1.extId < k2.extId : 
-			  								 k1.curPos < k2.curPos;});
+	groupMatches(vecMatches, groupedMatches, radixBuffer);
 
 	timeKmerIndexSecond += std::chrono::duration_cast<std::chrono::duration<float>>
 								(std::chrono::system_clock::now() - timeStart).count();
@@ -215,7 +419,7 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 	std::vector<OverlapRange> detectedOverlaps;
 	size_t extRangeBegin = 0;
 	size_t extRangeEnd = 0;
-	while(extRangeEnd < vecMatches.size())
+	while(extRangeEnd < groupedMatches.size())
 	{
 		if (maxOverlaps != 0 &&
 			detectedOverlaps.size() >= (size_t)maxOverlaps) break;
@@ -223,36 +427,37 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 		extRangeBegin = extRangeEnd;
 		size_t uniqueMatches = 0;
 		int32_t prevPos = 0;
-		while (extRangeEnd < vecMatches.size() &&
-			   vecMatches[extRangeBegin].extId == 
-			   vecMatches[extRangeEnd].extId)
+		while (extRangeEnd < groupedMatches.size() &&
+			   groupedMatches[extRangeBegin].extId == 
+			   groupedMatches[extRangeEnd].extId)
 		{
-			if (vecMatches[extRangeEnd].curPos != prevPos)
+			if (groupedMatches[extRangeEnd].curPos != prevPos)
 			{
 				++uniqueMatches;
-				prevPos = vecMatches[extRangeEnd].curPos;
+				prevPos = groupedMatches[extRangeEnd].curPos;
 			}
 			++extRangeEnd;
 		}
 		if (uniqueMatches < minKmerSruvivalRate * _minOverlap) continue;
 
-		matchesList.assign(vecMatches.begin() + extRangeBegin,
-						   vecMatches.begin() + extRangeEnd);
-		assert(matchesList.size() > 0 && 
-			   matchesList.size() < (size_t)std::numeric_limits<int32_t>::max());
+		//matches of the current candidate, processed in place
+		KmerMatch* matchesList = groupedMatches.data() + extRangeBegin;
+		size_t numMatches = extRangeEnd - extRangeBegin;
+		assert(numMatches > 0 && 
+			   numMatches < (size_t)std::numeric_limits<int32_t>::max());
 
-		FastaRecord::Id extId = matchesList.front().extId;
+		FastaRecord::Id extId = matchesList[0].extId;
 		int32_t extLen = _seqContainer.seqLen(extId);
 
 		//pre-filtering
-		int32_t minCur = matchesList.front().curPos;
-		int32_t maxCur = matchesList.back().curPos;
+		int32_t minCur = matchesList[0].curPos;
+		int32_t maxCur = matchesList[numMatches - 1].curPos;
 		int32_t minExt = std::numeric_limits<int32_t>::max();
 		int32_t maxExt = std::numeric_limits<int32_t>::min();
-		for (const auto& match : matchesList)
+		for (size_t i = 0; i < numMatches; ++i)
 		{
-			minExt = std::min(minExt, match.extPos);
-			maxExt = std::max(maxExt, match.extPos);
+			minExt = std::min(minExt, matchesList[i].extPos);
+			maxExt = std::max(maxExt, matchesList[i].extPos);
 		}
 		if (maxCur - minCur < _minOverlap || 
 			maxExt - minExt < _minOverlap) continue;
@@ -264,14 +469,31 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 		}
 		//++uniqueCandidates;
 
+		//skip candidates without a consistent diagonal (e.g. scattered
+		//repeat hits). The overlap test allows the overlap ranges to differ 
+		//by half of the overlap length, so the band width is chosen to 
+		//have at least _minOverlap of a linearly drifting chain within 
+		//the window of three bands
+		if (DIAGONAL_FILTER)
+		{
+			const int32_t bandWidth = std::max(1, std::max(_maxJump, _minOverlap / 4));
+			numMatches = filterDiagonalBands(matchesList, numMatches, bandWidth,
+											 _minOverlap - kmerSize, 
+											 minKmerSruvivalRate * _minOverlap);
+			if (numMatches == 0) continue;
+		}
+
 		//chain matiching positions with DP
-		scoreTable.assign(matchesList.size(), 0);
-		backtrackTable.assign(matchesList.size(), -1);
+		scoreTable.assign(numMatches, 0);
+		//after the band filter, the first match is often the actual
+		//chain start, so the chains are allowed to begin there
+		if (DIAGONAL_FILTER) scoreTable[0] = kmerSize;
+		backtrackTable.assign(numMatches, -1);
 
 		bool extSorted = extLen > curLen;
 		if (extSorted)
 		{
-			std::sort(matchesList.begin(), matchesList.end(),
+			std::sort(matchesList, matchesList + numMatches,
 					  [](const KmerMatch& k1, const KmerMatch& k2)
 					  {return k1.extPos < k2.extPos;});
 		}
@@ -327,7 +549,7 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 		//backtracking
 		std::vector<OverlapRange> extOverlaps;
 		//std::vector<int32_t> shifts;
-		std::vector<std::pair<int32_t, int32_t>> kmerMatches;
+		std::vector<MatchPair> kmerMatches;
 		
 		//initiate chains from the highest scores in the table (e.g. local maximums)
 		std::vector<size_t> orderedScores(backtrackTable.size());
@@ -386,7 +608,7 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 
 			//Logger::get().debug() << chainStart - firstMatch << " " << lastMatch - firstMatch;
 
-			OverlapRange ovlp(fastaRec.id, matchesList.front().extId,
+			OverlapRange ovlp(fastaRec.id, extId,
 							  matchesList[firstMatch].curPos, 
 							  matchesList[firstMatch].extPos,
 							  curLen, extLen);
@@ -402,8 +624,7 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 					kmerMatches.emplace_back(ovlp.curBegin, ovlp.extBegin);
 					std::reverse(kmerMatches.begin(), kmerMatches.end());
 					kmerMatches.emplace_back(ovlp.curEnd, ovlp.extEnd);
-					ovlp.kmerMatches = new std::vector<std::pair<int32_t, int32_t>>();
-					ovlp.kmerMatches->swap(kmerMatches);
+					ovlp.kmerMatches = MatchSpan::store(kmerMatches);
 				}
 				//ovlp.leftShift = median(shifts);
 				//ovlp.rightShift = extLen - curLen + ovlp.leftShift;
@@ -520,6 +741,8 @@ std::vector<OverlapRange>
 	OverlapContainer::quickSeqOverlaps(FastaRecord::Id readId, int maxOverlaps, 
 									   bool forceLocal)
 {
+	if (_precomputed) return this->storedSeqOverlaps(readId, maxOverlaps, 
+													 forceLocal);
 	//bool suggestChimeric;
 	const FastaRecord& record = _queryContainer.getRecord(readId);
 	return _ovlpDetect.getSeqOverlaps(record, forceLocal, 
@@ -534,8 +757,7 @@ std::vector<OverlapRange>
 									  _divergenceStats, maxOverlaps);
 }
 
-const std::vector<OverlapRange>&
-	OverlapContainer::lazySeqOverlaps(FastaRecord::Id readId)
+OverlapsHandle OverlapContainer::lazySeqOverlaps(FastaRecord::Id readId)
 {
 	bool flipped = !readId.strand();
 	if (flipped) readId = readId.rc();
@@ -544,28 +766,55 @@ const std::vector<OverlapRange>&
 	//upsert creates default value if it does not exist
 	_overlapIndex.upsert(readId, 	
 		[&wrapper](IndexVecWrapper& val)
-			{wrapper = val;});
+		{
+			val.referenced = true;
+			wrapper = val;
+		});
 	if (wrapper.cached)
 	{
-		return !flipped ? *wrapper.fwdOverlaps : *wrapper.revOverlaps;
+		++_cacheHits;
+		return !flipped ? wrapper.fwdOverlaps : wrapper.revOverlaps;
 	}
+	++_cacheMisses;
 
-	//otherwise, need to compute overlaps.
+	//otherwise, need to compute (or load) overlaps.
 	//do it for forward strand to be distinct
 	//bool suggestChimeric;
 	const bool DEFAULT_LOCAL = false;
-	const FastaRecord& record = _queryContainer.getRecord(readId);
-	auto overlaps = _ovlpDetect.getSeqOverlaps(record, DEFAULT_LOCAL, 
-											   _divergenceStats,
-											   _ovlpDetect._maxCurOverlaps);
+	std::vector<OverlapRange> overlaps;
+	if (_precomputed)
+	{
+		overlaps = this->loadSpilledOverlaps(readId, DEFAULT_LOCAL);
+	}
+	else
+	{
+		const FastaRecord& record = _queryContainer.getRecord(readId);
+		overlaps = _ovlpDetect.getSeqOverlaps(record, DEFAULT_LOCAL, 
+											  _divergenceStats,
+											  _ovlpDetect._maxCurOverlaps);
+	}
+	this->storeOverlaps(readId, overlaps, wrapper);
+
+	return !flipped ? wrapper.fwdOverlaps : wrapper.revOverlaps;
+}
+
+//stores the overlaps of the forward strand sequence (and their
+//complements), unless they were already stored by another thread
+void OverlapContainer::storeOverlaps(FastaRecord::Id readId,
+									 std::vector<OverlapRange>& overlaps,
+									 IndexVecWrapper& outWrapper)
+{
 	overlaps.shrink_to_fit();
 
 	std::vector<OverlapRange> revOverlaps;
 	revOverlaps.reserve(overlaps.size());
 	for (const auto& ovlp : overlaps) revOverlaps.push_back(ovlp.complement());
 
+	const size_t cacheBytes = 2 * overlaps.size() * sizeof(OverlapRange);
+	bool stored = false;
+	_overlapIndex.insert(readId);	//ensure it's in the table
 	_overlapIndex.update_fn(readId,
-		[&wrapper, &overlaps, &revOverlaps, this]
+		[&outWrapper, &overlaps, &revOverlaps, &stored, this]
 		(IndexVecWrapper& val)
 		{
 			if (!val.cached)
@@ -575,13 +824,87 @@ const std::vector<OverlapRange>&
 				*val.revOverlaps = std::move(revOverlaps);
 				//val.suggestChimeric = suggestChimeric;
 				val.cached = true;
+				val.referenced = true;
+				stored = true;
 			}
-			wrapper = val;
+			outWrapper = val;
 		});
 
-	return !flipped ? *wrapper.fwdOverlaps : *wrapper.revOverlaps;
+	if (stored && _cacheBudget > 0) this->admitToCache(readId, cacheBytes);
+}
+
+void OverlapContainer::setCacheBudget(size_t bytes)
+{
+	_cacheBudget = bytes;
+	Logger::get().debug() << "Overlap cache budget: " 
+		<< bytes / 1024 / 1024 << " Mb";
 }
 
+//Adds a newly stored sequence into the CLOCK ring of its shard, then
+//evicts sequences until the shard fits into its part of the budget.
+//The evicted entries are not removed from the index, but marked as not
+//cached, so the overlaps are recomputed on the next request. Handles
+//that were returned earlier still keep the evicted vectors alive.
+void OverlapContainer::admitToCache(FastaRecord::Id readId, size_t bytes)
+{
+	const size_t shardBudget = _cacheBudget / NUM_CACHE_SHARDS;
+	CacheShard& shard = _cacheShards[readId.hash() % NUM_CACHE_SHARDS];
+
+	std::lock_guard<std::mutex> lock(shard.lock);
+	shard.clockRing.push_back(readId);
+	shard.bytes += bytes;
+
+	while (shard.bytes > shardBudget && shard.clockRing.size() > 1)
+	{
+		if (shard.hand >= shard.clockRing.size()) shard.hand = 0;
+		FastaRecord::Id candidate = shard.clockRing[shard.hand];
+
+		size_t freedOverlaps = 0;
+		bool evicted = false;
+		_overlapIndex.update_fn(candidate,
+			[&freedOverlaps, &evicted](IndexVecWrapper& val)
+			{
+				if (val.referenced)
+				{
+					val.referenced = false;	//second chance
+					return;
+				}
+				freedOverlaps = val.fwdOverlaps->size();
+				val.fwdOverlaps.reset(new std::vector<OverlapRange>);
+				val.revOverlaps.reset(new std::vector<OverlapRange>);
+				val.cached = false;
+				evicted = true;
+			});
+
+		if (evicted)
+		{
+			shard.bytes -= 2 * freedOverlaps * sizeof(OverlapRange);
+			_indexSize -= freedOverlaps;
+			++_cacheEvictions;
+			shard.clockRing[shard.hand] = shard.clockRing.back();
+			shard.clockRing.pop_back();
+		}
+		else
+		{
+			++shard.hand;
+		}
+	}
+}
+
+void OverlapContainer::overlapCacheStats()
+{
+	const size_t requests = _cacheHits + _cacheMisses;
+	if (!requests) return;
+
+	Logger::get().debug() << "Overlap cache requests: " << requests
+		<< ", hits: " << 100 * _cacheHits / requests << "%, evictions: " 
+		<< _cacheEvictions;
+}
+
+//Reversed overlaps are exchanged in two parallel passes. First, the overlaps
+//of each chunk of sequences are reversed and split into buckets by the
+//target sequence. Then, each bucket is processed independently, appending
+//the reversed overlaps to the target lists in the order of the source chunks
 void OverlapContainer::ensureTransitivity(bool onlyMaxExt)
 {
 	Logger::get().debug() << "Computing transitive closure for overlaps";
@@ -592,50 +915,67 @@ void OverlapContainer::ensureTransitivity(bool onlyMaxExt)
 		allSeqs.push_back(seqIt.first);
 		allSeqs.push_back(seqIt.first.rc());
 	}
-
-	int totalOverlaps = 0;
-	for (const auto& seq : allSeqs)
+	std::sort(allSeqs.begin(), allSeqs.end());
+
+	const size_t NUM_CHUNKS = 256;
+	const size_t NUM_BUCKETS = 256;
+	const size_t chunkSize = allSeqs.size() / NUM_CHUNKS + 1;
+	std::vector<std::vector<std::vector<OverlapRange>>> 
+		exchange(NUM_CHUNKS, std::vector<std::vector<OverlapRange>>(NUM_BUCKETS));
+
+	std::vector<size_t> chunkIds(NUM_CHUNKS);
+	std::iota(chunkIds.begin(), chunkIds.end(), 0);
+	std::function<void(const size_t&)> reverseChunk = 
+	[this, &allSeqs, &exchange, chunkSize, NUM_BUCKETS] (const size_t& chunkId)
 	{
-		const auto& curOvlps = this->unsafeSeqOverlaps(seq);
-		totalOverlaps += curOvlps.size();
-		std::vector<OverlapRange> ovlpsToAdd;
-		for (auto& curOvlp : curOvlps)
+		for (size_t i = chunkId * chunkSize; 
+			 i < std::min(allSeqs.size(), (chunkId + 1) * chunkSize); ++i)
 		{
-			auto& extOvlps = this->unsafeSeqOverlaps(curOvlp.extId);
+			for (const auto& curOvlp : this->unsafeSeqOverlaps(allSeqs[i]))
+			{
+				size_t bucket = curOvlp.extId.rawId() % NUM_BUCKETS;
+				exchange[chunkId][bucket].push_back(curOvlp.reverse());
+			}
+		}
+	};
+	processInParallel(chunkIds, reverseChunk, 
+					  Parameters::get().numThreads, false);
 
-			if (onlyMaxExt)
+	std::vector<size_t> bucketIds(NUM_BUCKETS);
+	std::iota(bucketIds.begin(), bucketIds.end(), 0);
+	std::function<void(const size_t&)> addToBucket = 
+	[this, &exchange, onlyMaxExt, NUM_CHUNKS] (const size_t& bucketId)
+	{
+		for (size_t chunkId = 0; chunkId < NUM_CHUNKS; ++chunkId)
+		{
+			for (auto& revOvlp : exchange[chunkId][bucketId])
 			{
+				auto& extOvlps = this->unsafeSeqOverlaps(revOvlp.curId);
 				bool found = false;
-				for (auto& extOvlp : extOvlps)
+				if (onlyMaxExt)
 				{
-					if (extOvlp.extId == curOvlp.curId)
+					for (auto& extOvlp : extOvlps)
 					{
-						if (curOvlp.score > extOvlp.score)
+						if (extOvlp.extId == revOvlp.extId)
 						{
-							extOvlp = curOvlp.reverse();
+							if (revOvlp.score > extOvlp.score)
+							{
+								extOvlp = std::move(revOvlp);
+							}
+							found = true;
+							break;
 						}
-						found = true;
-						break;
 					}
 				}
-				if (!found)
-				{
-					ovlpsToAdd.push_back(curOvlp.reverse());
-				}
-			}
-			else
-			{
-				ovlpsToAdd.push_back(curOvlp.reverse());
+				if (!found) extOvlps.push_back(std::move(revOvlp));
 			}
+			std::vector<OverlapRange>().swap(exchange[chunkId][bucketId]);
 		}
-		for (const auto& ovlp : ovlpsToAdd)
-		{
-			this->unsafeSeqOverlaps(ovlp.curId).push_back(ovlp);
-		}
-	}
+	};
+	processInParallel(bucketIds, addToBucket, 
+					  Parameters::get().numThreads, false);
 }
 
-
 void OverlapContainer::findAllOverlaps()
 {
 	//Logger::get().info() << "Finding overlaps:";
@@ -648,11 +988,24 @@ void OverlapContainer::findAllOverlaps()
 		}
 	}
 
-	std::mutex indexMutex;
+	//in the half-matrix mode, overlaps are only computed against
+	//the sequences with the smaller or equal ids
+	const bool halfMatrix = (bool)Config::get("half_matrix_overlaps");
 	std::function<void(const FastaRecord::Id&)> indexUpdate = 
-	[this] (const FastaRecord::Id& seqId)
+	[this, halfMatrix] (const FastaRecord::Id& seqId)
 	{
-		this->lazySeqOverlaps(seqId);	//automatically stores overlaps
+		if (!halfMatrix)
+		{
+			this->lazySeqOverlaps(seqId);	//automatically stores overlaps
+			return;
+		}
+		auto overlaps = _ovlpDetect.getSeqOverlaps(_queryContainer.getRecord(seqId), 
+												   /*force local*/ false,
+												   _divergenceStats,
+												   _ovlpDetect._maxCurOverlaps,
+												   /*max ext id*/ seqId);
+		IndexVecWrapper wrapper;
+		this->storeOverlaps(seqId, overlaps, wrapper);
 	};
 	processInParallel(allQueries, indexUpdate, 
 					  Parameters::get().numThreads, true);
@@ -687,6 +1040,126 @@ std::vector<OverlapRange>&
 }
 
 //TODO: potentially might become non-symmetric after filtering
+void OverlapContainer::addPartitionOverlaps()
+{
+	if (!_spillFile)
+	{
+		//the file is removed right away, and is kept by the open
+		//handle until the container is destroyed
+		std::string spillPath = (!_tempDir.empty() ? _tempDir : ".") + 
+								"/partition_overlaps.bin";
+		_spillFile = fopen(spillPath.c_str(), "w+b");
+		if (!_spillFile) throw std::runtime_error("Can't open " + spillPath);
+		std::remove(spillPath.c_str());
+
+		for (const auto& seq : _queryContainer.iterSeqs())
+		{
+			if (seq.id.strand()) _spillSegments[seq.id];
+		}
+	}
+
+	std::vector<FastaRecord::Id> queries;
+	for (const auto& seq : _queryContainer.iterSeqs())
+	{
+		if (seq.id.strand()) queries.push_back(seq.id);
+	}
+	std::function<void(const FastaRecord::Id&)> computeParallel =
+	[this] (const FastaRecord::Id& queryId)
+	{
+		//local overlaps are the superset of the regular ones,
+		//so they are computed once and split by the overhang test on load
+		const FastaRecord& record = _queryContainer.getRecord(queryId);
+		auto overlaps = _ovlpDetect.getSeqOverlaps(record, /*force local*/ true,
+												   _divergenceStats, 
+												   /*max overlaps*/ 0);
+		if (overlaps.empty()) return;
+
+		std::lock_guard<std::mutex> lock(_spillLock);
+		if (fwrite(overlaps.data(), sizeof(OverlapRange), overlaps.size(),
+				   _spillFile) != overlaps.size())
+		{
+			throw std::runtime_error("Error writing partition overlaps");
+		}
+		_spillSegments[queryId].push_back({_spillOffset, overlaps.size()});
+		_spillOffset += overlaps.size() * sizeof(OverlapRange);
+	};
+	processInParallel(queries, computeParallel, 
+					  Parameters::get().numThreads, true);
+}
+
+void OverlapContainer::finalizePartitions()
+{
+	if (_spillFile) fflush(_spillFile);
+	_precomputed = true;
+
+	Logger::get().debug() << "Spilled overlaps: " 
+		<< _spillOffset / sizeof(OverlapRange) << " ("
+		<< _spillOffset / 1024 / 1024 << " Mb)";
+}
+
+//Loads the overlaps of the sequence from all partitions. They are
+//stored in the order of partitions, which are indexed in the order
+//of sequence ids, so the list is sorted by extId, as in getSeqOverlaps()
+std::vector<OverlapRange>
+	OverlapContainer::loadSpilledOverlaps(FastaRecord::Id readId, 
+										  bool forceLocal)
+{
+	bool flipped = !readId.strand();
+	std::vector<OverlapRange> overlaps;
+	auto segIt = _spillSegments.find(!flipped ? readId : readId.rc());
+	if (segIt == _spillSegments.end()) return overlaps;
+
+	{
+		std::lock_guard<std::mutex> lock(_spillLock);
+		for (const auto& segment : segIt->second)
+		{
+			size_t prevSize = overlaps.size();
+			overlaps.resize(prevSize + segment.count);
+			if (fseek(_spillFile, segment.offset, SEEK_SET) != 0 ||
+				fread(overlaps.data() + prevSize, sizeof(OverlapRange),
+					  segment.count, _spillFile) != segment.count)
+			{
+				throw std::runtime_error("Error reading partition overlaps");
+			}
+		}
+	}
+
+	//read overlaps are computed without k-mer matches, 
+	//so there is nothing to restore
+	for (auto& ovlp : overlaps) ovlp.kmerMatches = MatchSpan();
+	if (!forceLocal)
+	{
+		overlaps.erase(std::remove_if(overlaps.begin(), overlaps.end(),
+			[this](const OverlapRange& ovlp)
+			{return !_ovlpDetect.overlapTest(ovlp, /*force local*/ false);}),
+			overlaps.end());
+	}
+	if (flipped)
+	{
+		for (auto& ovlp : overlaps) ovlp = ovlp.complement();
+	}
+	return overlaps;
+}
+
+std::vector<OverlapRange>
+	OverlapContainer::storedSeqOverlaps(FastaRecord::Id readId, 
+										int maxOverlaps, bool forceLocal)
+{
+	std::vector<OverlapRange> overlaps = !forceLocal ? 
+		*this->lazySeqOverlaps(readId) : this->loadSpilledOverlaps(readId, 
+																	/*local*/ true);
+
+	//same order as the overlaps are reported by getSeqOverlaps()
+	std::stable_sort(overlaps.begin(), overlaps.end(),
+					 [](const OverlapRange& o1, const OverlapRange& o2)
+					 {return o1.extId < o2.extId;});
+	if (maxOverlaps > 0 && overlaps.size() > (size_t)maxOverlaps)
+	{
+		overlaps.resize(maxOverlaps);
+	}
+	return overlaps;
+}
+
 void OverlapContainer::filterOverlaps()
 {
 	static const int MAX_ENDS_DIFF = Parameters::get().kmerSize;
@@ -697,54 +1170,90 @@ void OverlapContainer::filterOverlaps()
 		seqIds.push_back(seq.id);
 	}
 
+	//overlap one is (almost) contained in overlap two
+	auto isContained = [] (const OverlapRange& ovlpOne, 
+						   const OverlapRange& ovlpTwo)
+	{
+		int curDiff = ovlpOne.curRange() - ovlpOne.curIntersect(ovlpTwo);
+		int extDiff = ovlpOne.extRange() - ovlpOne.extIntersect(ovlpTwo);
+		return curDiff < MAX_ENDS_DIFF && extDiff < MAX_ENDS_DIFF;
+	};
+
 	std::function<void(const FastaRecord::Id& seqId)> filterParallel =
-	[this] (const FastaRecord::Id& seqId)
+	[this, &isContained] (const FastaRecord::Id& seqId)
 	{
 		auto& overlaps = this->unsafeSeqOverlaps(seqId);
-		
-		SetVec<OverlapRange*> overlapSets;
-		for (auto& ovlp : overlaps) 
+
+		//duplicates could only share the same extId (which also defines
+		//the strand). Within the same extId, overlaps are sorted by start,
+		//and an overlap could only be merged with the ones that start 
+		//before its end (plus the allowed difference) - so instead of
+		//comparing all pairs, we only scan the nearby neighbors
+		std::vector<size_t> order(overlaps.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(),
+				  [&overlaps](size_t i, size_t j)
+				  {
+					  const OverlapRange& o1 = overlaps[i];
+					  const OverlapRange& o2 = overlaps[j];
+					  if (o1.extId != o2.extId) return o1.extId < o2.extId;
+					  if (o1.curBegin != o2.curBegin) 
+					  {
+						  return o1.curBegin < o2.curBegin;
+					  }
+					  return i < j;
+				  });
+
+		SetVec<size_t> overlapSets;
+		for (size_t idx : order) 
 		{
-			overlapSets.push_back(new SetNode<OverlapRange*>(&ovlp));
+			overlapSets.push_back(new SetNode<size_t>(idx));
 		}
 		for (size_t i = 0; i < overlapSets.size(); ++i)
 		{
-			for (size_t j = 0; j < overlapSets.size(); ++j)
+			const OverlapRange& ovlpOne = overlaps[overlapSets[i]->data];
+			for (size_t j = i + 1; j < overlapSets.size(); ++j)
 			{
-				OverlapRange& ovlpOne = *overlapSets[i]->data;
-				OverlapRange& ovlpTwo = *overlapSets[j]->data;
+				const OverlapRange& ovlpTwo = overlaps[overlapSets[j]->data];
+				if (ovlpOne.extId != ovlpTwo.extId ||
+					ovlpTwo.curBegin >= ovlpOne.curEnd + MAX_ENDS_DIFF) break;
 
-				if (ovlpOne.extId != ovlpTwo.extId) continue;
-				int curDiff = ovlpOne.curRange() - ovlpOne.curIntersect(ovlpTwo);
-				int extDiff = ovlpOne.extRange() - ovlpOne.extIntersect(ovlpTwo);
-
-				if (curDiff < MAX_ENDS_DIFF && extDiff < MAX_ENDS_DIFF) 
+				if (isContained(ovlpOne, ovlpTwo) || 
+					isContained(ovlpTwo, ovlpOne))
 				{
 					unionSet(overlapSets[i], overlapSets[j]);
 				}
 			}
 		}
-		auto clusters = groupBySet(overlapSets);
-		std::vector<OverlapRange> newOvlps;
-		for (const auto& cluster : clusters)
+
+		//the best scoring overlap represents the cluster (the first one
+		//in the original order if tied), and the representatives are
+		//kept in the original order, so the output is deterministic
+		std::unordered_map<SetNode<size_t>*, size_t> clusterMax;
+		for (auto& setNode : overlapSets)
 		{
-			OverlapRange* maxOvlp = nullptr;
-			for (auto& ovlp : cluster.second)
+			auto maxIt = clusterMax.emplace(findSet(setNode), setNode->data).first;
+			const OverlapRange& curMax = overlaps[maxIt->second];
+			const OverlapRange& ovlp = overlaps[setNode->data];
+			if (ovlp.score > curMax.score ||
+				(ovlp.score == curMax.score && setNode->data < maxIt->second))
 			{
-				if (!maxOvlp || ovlp->score > maxOvlp->score)
-				{
-					maxOvlp = ovlp;
-				}
+				maxIt->second = setNode->data;
 			}
-			newOvlps.push_back(*maxOvlp);
 		}
-		newOvlps.shrink_to_fit();
-		overlaps = std::move(newOvlps);
+		std::vector<size_t> keepIds;
+		keepIds.reserve(clusterMax.size());
+		for (const auto& cluster : clusterMax) keepIds.push_back(cluster.second);
+		std::sort(keepIds.begin(), keepIds.end());
 
-		std::sort(overlaps.begin(), overlaps.end(), 
-				  [](const OverlapRange& o1, const OverlapRange& o2)
-				  {return o1.curBegin < o2.curBegin;});
+		std::vector<OverlapRange> newOvlps;
+		newOvlps.reserve(keepIds.size());
+		for (size_t idx : keepIds) newOvlps.push_back(overlaps[idx]);
+		overlaps = std::move(newOvlps);
 
+		std::stable_sort(overlaps.begin(), overlaps.end(), 
+						 [](const OverlapRange& o1, const OverlapRange& o2)
+						 {return o1.curBegin < o2.curBegin;});
 	};
 	processInParallel(seqIds, filterParallel, 
 					  Parameters::get().numThreads, false);
@@ -918,17 +1427,17 @@ void OverlapContainer::buildIntervalTree()
 
 	for (const auto& seq : allSeqs)
 	{
-		std::vector<Interval<const OverlapRange*>> intervals;
+		std::vector<OverlapIntervals::Interval> intervals;
 		auto& overlaps = this->unsafeSeqOverlaps(seq);
 		for (const auto& ovlp : overlaps)
 		{
 			intervals.emplace_back(ovlp.curBegin, ovlp.curEnd, &ovlp);
 		}
-		_ovlpTree[seq] = IntervalTree<const OverlapRange*>(intervals);
+		_ovlpTree[seq] = OverlapIntervals(intervals);
 	}
 }
 
-std::vector<Interval<const OverlapRange*>> 
+std::vector<OverlapContainer::OverlapIntervals::Interval> 
 	OverlapContainer::getCoveringOverlaps(FastaRecord::Id seqId, 
 								  int32_t start, int32_t end) const
 {
@@ -7,84 +7,88 @@
 #include <unordered_set>
 #include <mutex>
 #include <sstream>
+#include <array>
+#include <memory>
+#include <cstdio>
 
 #include <cuckoohash_map.hh>
-#include "IntervalTree.h"
 
 #include "vertex_index.h"
 #include "sequence_container.h"
 #include "../common/logger.h"
 #include "../common/progress_bar.h"
+#include "../common/interval_index.h"
 
 
-struct OverlapRange
-{
-	OverlapRange(FastaRecord::Id curId = FastaRecord::ID_NONE, 
-				 FastaRecord::Id extId = FastaRecord::ID_NONE, 
-				 int32_t curInit = 0, int32_t extInit = 0,
-				 int32_t curLen = 0, int32_t extLen = 0): 
-		curId(curId), curBegin(curInit), curEnd(curInit), curLen(curLen),
-		extId(extId), extBegin(extInit), extEnd(extInit), extLen(extLen),
-		score(0), seqDivergence(0.0f), kmerMatches(nullptr)
-	{}
+typedef std::pair<int32_t, int32_t> MatchPair;	//(cur, ext) positions
 
-	~OverlapRange()
+//Bump allocator for the k-mer match lists of overlaps. Each thread
+//appends to its own block, so the lists are allocated without locking
+//or malloc calls. The memory is only released all at once by release(),
+//which should be called when no overlaps with the stored matches are
+//alive anymore (e.g. after the repeat graph is constructed)
+class MatchArena
+{
+public:
+	static MatchArena& get()
 	{
-		if (kmerMatches)
-		{
-			delete kmerMatches;
-			kmerMatches = nullptr;
-		}
+		static MatchArena instance;
+		return instance;
 	}
 
-	OverlapRange(const OverlapRange& other):
-		curId(other.curId), curBegin(other.curBegin), curEnd(other.curEnd), curLen(other.curLen), 
-		extId(other.extId), extBegin(other.extBegin), extEnd(other.extEnd), extLen(other.extLen),
-		score(other.score), seqDivergence(other.seqDivergence), kmerMatches(nullptr)
-	{
-		if (other.kmerMatches)
-		{
-			kmerMatches = new std::vector<std::pair<int32_t, int32_t>>();
-			*kmerMatches = *other.kmerMatches;
-		}
-	}
+	MatchPair* allocate(size_t size);
+	void release();
+	size_t allocatedBytes() const {return _allocatedBytes;}
 
-	OverlapRange& operator=(const OverlapRange& other)
-	{
-		curId = other.curId;
-		curBegin = other.curBegin;
-		curEnd = other.curEnd; 
-		curLen = other.curLen;
-		extId = other.extId;
-		extBegin = other.extBegin;
-		extEnd = other.extEnd;
-		extLen = other.extLen;
-		score = other.score;
-		seqDivergence = other.seqDivergence;
-
-		if (!other.kmerMatches)
-		{
-			if (kmerMatches) delete kmerMatches;
-			kmerMatches = nullptr;
-		}
-		else
-		{
-			if (!kmerMatches) kmerMatches = new std::vector<std::pair<int32_t, int32_t>>();
-			kmerMatches->clear();
-			*kmerMatches = *other.kmerMatches;
-		}
+private:
+	MatchArena(): _generation(0), _allocatedBytes(0) {}
+	MatchArena(const MatchArena&) = delete;
+	void operator=(const MatchArena&) = delete;
+
+	std::mutex _blocksLock;
+	std::vector<std::unique_ptr<MatchPair[]>> _blocks;
+	std::atomic<size_t> _generation;
+	std::atomic<size_t> _allocatedBytes;
+};
 
-		return *this;
-	}
+//An immutable list of k-mer matches stored in MatchArena. Copies of
+//an overlap share the same list, and the transformations (reverse,
+//complement) store the modified list as a new span
+class MatchSpan
+{
+public:
+	MatchSpan(): _data(nullptr), _size(0) {}
+	MatchSpan(const MatchPair* data, uint32_t size): 
+		_data(data), _size(size) {}
 
-	OverlapRange(OverlapRange&& other):
-		curId(other.curId), curBegin(other.curBegin), curEnd(other.curEnd), curLen(other.curLen), 
-		extId(other.extId), extBegin(other.extBegin), extEnd(other.extEnd), extLen(other.extLen),
-		score(other.score), seqDivergence(other.seqDivergence), kmerMatches(other.kmerMatches)
+	static MatchSpan store(const std::vector<MatchPair>& matches)
 	{
-		other.kmerMatches = nullptr;
+		MatchPair* data = MatchArena::get().allocate(matches.size());
+		std::copy(matches.begin(), matches.end(), data);
+		return MatchSpan(data, matches.size());
 	}
 
+	const MatchPair* begin() const {return _data;}
+	const MatchPair* end() const {return _data + _size;}
+	const MatchPair& operator[](size_t i) const {return _data[i];}
+	size_t size() const {return _size;}
+	bool empty() const {return _size == 0;}
+
+private:
+	const MatchPair* _data;
+	uint32_t _size;
+};
+
+struct OverlapRange
+{
+	OverlapRange(FastaRecord::Id curId = FastaRecord::ID_NONE, 
+				 FastaRecord::Id extId = FastaRecord::ID_NONE, 
+				 int32_t curInit = 0, int32_t extInit = 0,
+				 int32_t curLen = 0, int32_t extLen = 0): 
+		curId(curId), curBegin(curInit), curEnd(curInit), curLen(curLen),
+		extId(extId), extBegin(extInit), extEnd(extInit), extLen(extLen),
+		score(0), seqDivergence(0.0f)
+	{}
 
 	int32_t curRange() const {return curEnd - curBegin;}
 
@@ -100,16 +104,19 @@ struct OverlapRange
 		std::swap(rev.curEnd, rev.extEnd);
 		std::swap(rev.curLen, rev.extLen);
 
-		if (rev.kmerMatches)
+		if (!kmerMatches.empty())
 		{
-			for (auto& posPair : *rev.kmerMatches) 
+			MatchPair* revMatches = 
+				MatchArena::get().allocate(kmerMatches.size());
+			for (size_t i = 0; i < kmerMatches.size(); ++i) 
 			{
-				std::swap(posPair.first, posPair.second);
+				revMatches[i] = MatchPair(kmerMatches[i].second,
+										  kmerMatches[i].first);
 			}
-			std::sort(rev.kmerMatches->begin(), rev.kmerMatches->end(),
-					  [](const std::pair<int32_t, int32_t>& p1,
-						 const std::pair<int32_t, int32_t>& p2)
+			std::sort(revMatches, revMatches + kmerMatches.size(),
+					  [](const MatchPair& p1, const MatchPair& p2)
 						 {return p1.first < p2.first;});
+			rev.kmerMatches = MatchSpan(revMatches, kmerMatches.size());
 		}
 
 		return rev;
@@ -133,14 +140,17 @@ struct OverlapRange
 		comp.curId = comp.curId.rc();
 		comp.extId = comp.extId.rc();
 
-		if (comp.kmerMatches)
+		if (!kmerMatches.empty())
 		{
-			for (auto& posPair : *comp.kmerMatches) 
+			const size_t numMatches = kmerMatches.size();
+			MatchPair* compMatches = MatchArena::get().allocate(numMatches);
+			for (size_t i = 0; i < numMatches; ++i) 
 			{
-				posPair.first = curLen - posPair.first - 1, 
-				posPair.second = extLen - posPair.second - 1;
+				const MatchPair& posPair = kmerMatches[numMatches - i - 1];
+				compMatches[i] = MatchPair(curLen - posPair.first - 1, 
+										   extLen - posPair.second - 1);
 			}
-			std::reverse(comp.kmerMatches->begin(), comp.kmerMatches->end());
+			comp.kmerMatches = MatchSpan(compMatches, numMatches);
 		}
 
 		return comp;
@@ -151,7 +161,7 @@ struct OverlapRange
 		if (curPos <= curBegin) return extBegin;
 		if (curPos >= curEnd) return extEnd;
 
-		if (!kmerMatches)
+		if (kmerMatches.empty())
 		{
 			float lengthRatio = (float)this->extRange() / this->curRange();
 			int32_t projectedPos = extBegin +
@@ -160,25 +170,22 @@ struct OverlapRange
 		}
 		else
 		{
-			auto cmpFirst = [] (const std::pair<int32_t, int32_t>& pair,
-							  	int32_t value)
+			auto cmpFirst = [] (const MatchPair& pair, int32_t value)
 								{return pair.first < value;};
-			size_t i = std::lower_bound(kmerMatches->begin(), kmerMatches->end(),
-										curPos, cmpFirst) - kmerMatches->begin();
-			if(i == 0 || i == kmerMatches->size()) 
+			size_t i = std::lower_bound(kmerMatches.begin(), kmerMatches.end(),
+										curPos, cmpFirst) - kmerMatches.begin();
+			if(i == 0 || i == kmerMatches.size()) 
 			{
 				throw std::runtime_error("Error in overlap projection");
 			}
 
-			int32_t curInt = (*kmerMatches)[i].first -
-							 (*kmerMatches)[i - 1].first;
-			int32_t extInt = (*kmerMatches)[i].second -
-							 (*kmerMatches)[i - 1].second;
+			int32_t curInt = kmerMatches[i].first - kmerMatches[i - 1].first;
+			int32_t extInt = kmerMatches[i].second - kmerMatches[i - 1].second;
 			float lengthRatio = (float)extInt / curInt;
-			int32_t projectedPos = (*kmerMatches)[i - 1].second +
-							float(curPos - (*kmerMatches)[i - 1].first) * lengthRatio;
-			return std::max((*kmerMatches)[i - 1].second,
-							std::min(projectedPos, (*kmerMatches)[i].second));
+			int32_t projectedPos = kmerMatches[i - 1].second +
+							float(curPos - kmerMatches[i - 1].first) * lengthRatio;
+			return std::max(kmerMatches[i - 1].second,
+							std::min(projectedPos, kmerMatches[i].second));
 		}
 	}
 
@@ -275,7 +282,7 @@ struct OverlapRange
 	int32_t score;
 	float   seqDivergence;
 
-	std::vector<std::pair<int32_t, int32_t>>* kmerMatches;
+	MatchSpan kmerMatches;
 };
 
 
@@ -338,11 +345,14 @@ public:
 	friend class OverlapContainer;
 
 private:
+	//if maxExtId is set, only the ext sequences with the forward 
+	//strand id not greater than maxExtId are considered
 	std::vector<OverlapRange> 
 	getSeqOverlaps(const FastaRecord& fastaRec, 
 				   bool forceLocal,
 				   OvlpDivStats& divergenceStats,
-				   int maxOverlaps) const;
+				   int maxOverlaps,
+				   FastaRecord::Id maxExtId = FastaRecord::ID_NONE) const;
 
 	bool    overlapTest(const OverlapRange& ovlp, bool forceLocal) const;
 
@@ -366,6 +376,28 @@ private:
 };
 
 
+//A reference to the stored overlaps of a sequence. Holds the overlap
+//vector, so it remains valid even if it is evicted from the cache
+class OverlapsHandle
+{
+public:
+	typedef std::vector<OverlapRange>::const_iterator const_iterator;
+
+	OverlapsHandle(std::shared_ptr<std::vector<OverlapRange>> overlaps):
+		_overlaps(overlaps) {}
+
+	const std::vector<OverlapRange>& operator*() const {return *_overlaps;}
+	const std::vector<OverlapRange>* operator->() const 
+		{return _overlaps.get();}
+
+	const_iterator begin() const {return _overlaps->begin();}
+	const_iterator end() const {return _overlaps->end();}
+	size_t size() const {return _overlaps->size();}
+
+private:
+	std::shared_ptr<std::vector<OverlapRange>> _overlaps;
+};
+
 class OverlapContainer
 {
 public:
@@ -375,24 +407,39 @@ public:
 		_queryContainer(queryContainer),
 		_indexSize(0),
 		//_kmerIdyEstimateBias(0),
-		_meanTrueOvlpDiv(0)
+		_meanTrueOvlpDiv(0),
+		_precomputed(false),
+		_spillFile(nullptr),
+		_spillOffset(0),
+		_cacheBudget(0),
+		_cacheHits(0),
+		_cacheMisses(0),
+		_cacheEvictions(0)
 	{}
 
+	~OverlapContainer()
+	{
+		if (_spillFile) fclose(_spillFile);
+	}
+
 	struct IndexVecWrapper
 	{
 		IndexVecWrapper(): 
 			fwdOverlaps(new std::vector<OverlapRange>), 
 			revOverlaps(new std::vector<OverlapRange>), 
 			cached(false),
-			suggestChimeric(false)
+			suggestChimeric(false),
+			referenced(false)
 		{}
 		IndexVecWrapper(const FastaRecord::Id);
 		std::shared_ptr<std::vector<OverlapRange>> fwdOverlaps;
 		std::shared_ptr<std::vector<OverlapRange>> revOverlaps;
 		bool cached;
 		bool suggestChimeric;
+		bool referenced;	//CLOCK bit, set on every cache hit
 	};
 	typedef cuckoohash_map<FastaRecord::Id, IndexVecWrapper> OverlapIndex;
+	typedef IntervalIndex<const OverlapRange*> OverlapIntervals;
 
 	//This conteiner is designed to find overlaps in parallel
 	//and store them dynamically. The first two functions
@@ -400,7 +447,9 @@ public:
 
 	//Finds overlaps and stores them, so the next call with the same
 	//readId is simply referencing to the computed overlaps.
-	const std::vector<OverlapRange>& lazySeqOverlaps(FastaRecord::Id readId);
+	//If the cache budget is set, stored overlaps might be evicted
+	//and then recomputed on the next request.
+	OverlapsHandle lazySeqOverlaps(FastaRecord::Id readId);
 
 	//Checks if read has self-overlaps (for chimera detection)
 	bool hasSelfOverlaps(FastaRecord::Id seqId);
@@ -417,9 +466,18 @@ public:
 	size_t indexSize() {return _indexSize;}
 
 	void estimateOverlaperParameters();
+	float getMeanDivergence() const {return _meanTrueOvlpDiv;}
+	void  setMeanDivergence(float divergence) {_meanTrueOvlpDiv = divergence;}
 
 	void setDivergenceThreshold(float threshold, bool isRelative);
 
+	//Limits the memory used by the lazily cached overlaps (0 = unlimited).
+	//Only for the containers that are filled by lazySeqOverlaps() (or
+	//by the partitioned indexing, which reloads them from the disk):
+	//the overlaps from findAllOverlaps() can not be recomputed after eviction
+	void setCacheBudget(size_t bytes);
+	void overlapCacheStats();
+
 	float getDivergenceThreshold() {return _ovlpDetect._maxDivergence;}
 
 	//The functions below are NOT thread safe.
@@ -433,18 +491,39 @@ public:
 	void overlapDivergenceStats();
 	void overlapDivergenceStats(const OvlpDivStats& stats, float divThreshold);
 
-	//Computes and stores all-vs-all overlaps
+	//Computes and stores all-vs-all overlaps. In the half-matrix mode
+	//(half_matrix_overlaps config option) each pair of sequences is
+	//only aligned once, and the mirror overlaps are added by 
+	//ensureTransitivity()
 	void findAllOverlaps();
+
+	//Partitioned indexing: computes overlaps of all query sequences
+	//against the currently indexed partition and spills them into
+	//a temporary file in the given directory. After finalizePartitions(),
+	//all overlaps (including the quickSeqOverlaps() calls) are loaded
+	//from this file, and are cached the same way as lazySeqOverlaps()
+	void setTempDirectory(const std::string& dir) {_tempDir = dir;}
+	void addPartitionOverlaps();
+	void finalizePartitions();
 	void buildIntervalTree();
-	std::vector<Interval<const OverlapRange*>> 
+	std::vector<OverlapIntervals::Interval> 
 		getCoveringOverlaps(FastaRecord::Id seqId, int32_t start, 
 							int32_t end) const;
 
 private:
 	std::vector<OverlapRange>& unsafeSeqOverlaps(FastaRecord::Id);
+	void storeOverlaps(FastaRecord::Id readId, 
+					   std::vector<OverlapRange>& overlaps,
+					   IndexVecWrapper& outWrapper);
+	std::vector<OverlapRange>  storedSeqOverlaps(FastaRecord::Id readId,
+												 int maxOverlaps,
+												 bool forceLocal);
 	//std::vector<OverlapRange>  seqOverlaps(FastaRecord::Id readId,
 	//									   bool& outSuggestChimeric) const;
 	void filterOverlaps();
+	void admitToCache(FastaRecord::Id readId, size_t bytes);
+	std::vector<OverlapRange> loadSpilledOverlaps(FastaRecord::Id readId,
+												  bool forceLocal);
 
 	const OverlapDetector&   _ovlpDetect;
 	const SequenceContainer& _queryContainer;
@@ -452,11 +531,44 @@ private:
 	OvlpDivStats _divergenceStats;
 	OverlapIndex _overlapIndex;
 	std::atomic<size_t> _indexSize;
-	std::unordered_map<FastaRecord::Id, 
-					   IntervalTree<const OverlapRange*>> _ovlpTree;
+	std::unordered_map<FastaRecord::Id, OverlapIntervals> _ovlpTree;
 
 	//float _kmerIdyEstimateBias;
 	float _meanTrueOvlpDiv;
+
+	//partitioned indexing. Overlaps of each sequence are spilled as
+	//one segment per partition. The local overlaps (that do not pass
+	//the overhang test) are spilled too and are filtered out on load
+	struct SpillSegment
+	{
+		uint64_t offset;
+		uint64_t count;
+	};
+	bool _precomputed;
+	std::string _tempDir;
+	FILE* _spillFile;
+	uint64_t _spillOffset;
+	std::mutex _spillLock;
+	std::unordered_map<FastaRecord::Id, 
+					   std::vector<SpillSegment>> _spillSegments;
+
+	//bounded overlap cache. Cached sequences are split into shards,
+	//each with its own lock, CLOCK ring and a part of the budget
+	struct CacheShard
+	{
+		CacheShard(): hand(0), bytes(0) {}
+
+		std::mutex lock;
+		std::vector<FastaRecord::Id> clockRing;
+		size_t hand;
+		size_t bytes;
+	};
+	static const size_t NUM_CACHE_SHARDS = 64;
+	size_t _cacheBudget;
+	std::array<CacheShard, NUM_CACHE_SHARDS> _cacheShards;
+	std::atomic<size_t> _cacheHits;
+	std::atomic<size_t> _cacheMisses;
+	std::atomic<size_t> _cacheEvictions;
 };
 
 //a helper to iterate over overlaps with no overhangs
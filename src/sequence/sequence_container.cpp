@@ -8,10 +8,13 @@
 #include <iostream>
 #include <random>
 #include <algorithm>
+#include <deque>
 #include <zlib.h>
 
 #include "sequence_container.h"
 #include "../common/logger.h"
+#include "../common/config.h"
+#include "../common/parallel.h"
 
 size_t SequenceContainer::g_nextSeqId = 0;
 
@@ -78,32 +81,168 @@ FastaRecord::Id SequenceContainer::addSequence(const FastaRecord& seqRec)
 	return _seqIndex.back().id.rc();
 }
 
+//Reads are parsed (and decompressed) in a separate thread, which passes
+//batches of raw reads to the worker threads for packing. The packed
+//batches are added to the container in the input order. Sequences with 
+//invalid characters are validated during the (sequential) addition, 
+//so the random replacements do not depend on the number of threads
 void SequenceContainer::loadFromFile(const std::string& fileName, 
-									 int minReadLength)
+									 int minReadLength,
+									 const SequenceCallback& onPacked)
+{
+	struct ReadBatch
+	{
+		std::vector<std::string> headers;
+		std::vector<std::string> sequences;
+		std::vector<DnaSequence> packed;
+		std::vector<bool> 		 invalid;
+	};
+	const size_t BATCH_BASES = 1024 * 1024;
+	const size_t numThreads = std::max((size_t)1, Parameters::get().numThreads);
+	this->isFasta(fileName);	//fails early on unknown file types
+
+	std::function<void(std::function<void(ReadBatch&&)>)> parseReads = 
+	[this, &fileName, BATCH_BASES] 
+		(std::function<void(ReadBatch&&)> passBatch)
+	{
+		ReadBatch batch;
+		size_t batchBases = 0;
+		RecordCallback addRecord = 
+		[&batch, &batchBases, &passBatch, BATCH_BASES]
+			(std::string& header, std::string& sequence)
+		{
+			batchBases += sequence.length();
+			batch.headers.push_back(std::move(header));
+			batch.sequences.push_back(std::move(sequence));
+			if (batchBases >= BATCH_BASES)
+			{
+				passBatch(std::move(batch));
+				batch = ReadBatch();
+				batchBases = 0;
+			}
+		};
+		this->parseFile(fileName, addRecord);
+		if (!batch.headers.empty()) passBatch(std::move(batch));
+	};
+
+	std::function<void(ReadBatch&)> packReads = 
+	[minReadLength, &onPacked] (ReadBatch& batch)
+	{
+		batch.packed.reserve(batch.sequences.size());
+		for (const auto& sequence : batch.sequences)
+		{
+			bool invalid = false;
+			for (char c : sequence) 
+			{
+				if (DnaSequence::dnaToId(c) == -1U) invalid = true;
+			}
+			batch.invalid.push_back(invalid);
+			if (!invalid && sequence.length() > (size_t)minReadLength)
+			{
+				batch.packed.emplace_back(sequence);
+				if (onPacked) onPacked(batch.packed.back());
+			}
+			else
+			{
+				batch.packed.emplace_back();
+			}
+		}
+	};
+
+	std::function<void(ReadBatch&)> addReads = 
+	[this, minReadLength, &onPacked] (ReadBatch& batch)
+	{
+		for (size_t i = 0; i < batch.sequences.size(); ++i)
+		{
+			if (batch.invalid[i])
+			{
+				this->validateSequence(batch.sequences[i]);
+				if (batch.sequences[i].length() > (size_t)minReadLength)
+				{
+					batch.packed[i] = DnaSequence(batch.sequences[i]);
+					if (onPacked) onPacked(batch.packed[i]);
+				}
+			}
+			if (batch.sequences[i].length() > (size_t)minReadLength)
+			{
+				this->addSequence({batch.packed[i], batch.headers[i],
+								   FastaRecord::ID_NONE});
+			}
+		}
+	};
+
+	processInPipeline(parseReads, packReads, addReads,
+					  numThreads, /*max queued batches*/ 2 * numThreads);
+}
+
+size_t SequenceContainer::parseFile(const std::string& fileName,
+									const RecordCallback& addRecord,
+									size_t rangeStart, size_t rangeEnd)
 {
-	std::vector<FastaRecord> records;
 	if (this->isFasta(fileName))
 	{
-		this->readFasta(records, fileName);
+		return this->readFasta(fileName, addRecord, rangeStart, rangeEnd);
 	}
 	else
 	{
-		this->readFastq(records, fileName);
+		return this->readFastq(fileName, addRecord, rangeStart, rangeEnd);
 	}
-	
-	//shuffling input reads
-	//std::vector<size_t> indicesPerm(records.size());
-	//for (size_t i = 0; i < indicesPerm.size(); ++i) indicesPerm[i] = i;
-	//std::random_shuffle(indicesPerm.begin(), indicesPerm.end());
+}
 
-	//for (size_t i : indicesPerm)
-	for (size_t i = 0; i < records.size(); ++i)
+//Range boundaries are found by seeking into the file and reading until
+//the next record start: a '>' line for fasta, and for fastq an '@' line
+//followed by a '+' line two lines later (a quality line that starts
+//with '@' is followed by a header and a sequence instead)
+std::vector<size_t> SequenceContainer::splitFile(const std::string& fileName,
+												 size_t chunkSize)
+{
+	bool fasta = this->isFasta(fileName);
+	std::ifstream fin(fileName, std::ios::binary | std::ios::ate);
+	if (!fin) throw ParseException("Can't open reads file");
+	const size_t fileSize = fin.tellg();
+	const size_t NO_END = std::numeric_limits<size_t>::max();
+
+	std::vector<size_t> boundaries = {0};
+	if (fileName.substr(fileName.size() - 3) == ".gz" || chunkSize == 0)
+	{
+		boundaries.push_back(NO_END);
+		return boundaries;
+	}
+
+	std::string line;
+	for (size_t offset = chunkSize; offset < fileSize; offset += chunkSize)
 	{
-		if (records[i].sequence.length() > (size_t)minReadLength)
+		fin.clear();
+		fin.seekg(offset - 1);
+		std::getline(fin, line);	//to the next line start
+
+		size_t recordStart = NO_END;
+		std::deque<std::pair<size_t, char>> lineStarts;
+		while (recordStart == NO_END)
 		{
-			this->addSequence(records[i]);
+			size_t linePos = fin.tellg();
+			if (!std::getline(fin, line)) break;
+			if (line.empty()) continue;
+			if (fasta)
+			{
+				if (line[0] == '>') recordStart = linePos;
+				continue;
+			}
+			lineStarts.emplace_back(linePos, line[0]);
+			if (lineStarts.size() == 3)
+			{
+				if (lineStarts[0].second == '@' && lineStarts[2].second == '+')
+				{
+					recordStart = lineStarts[0].first;
+				}
+				lineStarts.pop_front();
+			}
 		}
+		if (recordStart == NO_END) break;
+		if (recordStart > boundaries.back()) boundaries.push_back(recordStart);
 	}
+	boundaries.push_back(NO_END);
+	return boundaries;
 }
 
 int SequenceContainer::computeNxStat(float fraction) const
@@ -142,8 +281,9 @@ const FastaRecord&
 	return _seqIndex[newId._id - _seqIdOffest];
 }
 
-size_t SequenceContainer::readFasta(std::vector<FastaRecord>& record, 
-									const std::string& fileName)
+size_t SequenceContainer::readFasta(const std::string& fileName,
+									const RecordCallback& addRecord,
+									size_t rangeStart, size_t rangeEnd)
 {
 	size_t BUF_SIZE = 32 * 1024 * 1024;
 	char* rawBuffer = new char[BUF_SIZE];
@@ -153,8 +293,14 @@ size_t SequenceContainer::readFasta(std::vector<FastaRecord>& record,
 		delete[] rawBuffer;
 		throw ParseException("Can't open reads file");
 	}
+	if (rangeStart > 0 && gzseek(fd, rangeStart, SEEK_SET) < 0)
+	{
+		delete[] rawBuffer;
+		gzclose(fd);
+		throw ParseException("Can't seek in reads file");
+	}
 
-	record.clear();
+	size_t numRecords = 0;
 	int lineNo = 1;
 	std::string header; 
 	std::string sequence;
@@ -164,6 +310,7 @@ size_t SequenceContainer::readFasta(std::vector<FastaRecord>& record,
 		while(!gzeof(fd))
 		{
 			//get a new line
+			size_t lineStart = gztell(fd);
 			for (;;)
 			{
 				char* read = gzgets(fd, rawBuffer, BUF_SIZE);
@@ -182,12 +329,13 @@ size_t SequenceContainer::readFasta(std::vector<FastaRecord>& record,
 
 			if (nextLine[0] == '>')
 			{
+				if (lineStart >= rangeEnd) break;
 				if (!header.empty())
 				{
 					if (sequence.empty()) throw ParseException("empty sequence");
 
-					record.emplace_back(DnaSequence(sequence), header, 
-										FastaRecord::ID_NONE);
+					addRecord(header, sequence);
+					++numRecords;
 					sequence.clear();
 					header.clear();
 				}
@@ -196,7 +344,6 @@ size_t SequenceContainer::readFasta(std::vector<FastaRecord>& record,
 			}
 			else
 			{
-				this->validateSequence(nextLine);
 				std::copy(nextLine.begin(), nextLine.end(), 
 						  std::back_inserter(sequence));
 			}
@@ -210,27 +357,33 @@ size_t SequenceContainer::readFasta(std::vector<FastaRecord>& record,
 		{
 			throw ParseException("Fasta fromat error");
 		}
-		record.emplace_back(DnaSequence(sequence), header, 
-							FastaRecord::ID_NONE);
-
+		addRecord(header, sequence);
+		++numRecords;
 	}
 	catch (ParseException& e)
 	{
 		std::stringstream ss;
 		ss << "parse error in " << fileName << " on line " << lineNo << ": " << e.what();
+		delete[] rawBuffer;
 		gzclose(fd);
 		throw ParseException(ss.str());
 	}
+	catch (...)
+	{
+		delete[] rawBuffer;
+		gzclose(fd);
+		throw;
+	}
 
 	delete[] rawBuffer;
 	gzclose(fd);
-	return record.size();
+	return numRecords;
 }
 
-size_t SequenceContainer::readFastq(std::vector<FastaRecord>& record, 
-									const std::string& fileName)
+size_t SequenceContainer::readFastq(const std::string& fileName,
+									const RecordCallback& addRecord,
+									size_t rangeStart, size_t rangeEnd)
 {
-
 	size_t BUF_SIZE = 32 * 1024 * 1024;
 	char* rawBuffer = new char[BUF_SIZE];
 	auto* fd = gzopen(fileName.c_str(), "rb");
@@ -239,8 +392,14 @@ size_t SequenceContainer::readFastq(std::vector<FastaRecord>& record,
 		delete[] rawBuffer;
 		throw ParseException("Can't open reads file");
 	}
+	if (rangeStart > 0 && gzseek(fd, rangeStart, SEEK_SET) < 0)
+	{
+		delete[] rawBuffer;
+		gzclose(fd);
+		throw ParseException("Can't seek in reads file");
+	}
 
-	record.clear();
+	size_t numRecords = 0;
 	int lineNo = 1;
 	int stateCounter = 0;
 	std::string header; 
@@ -250,6 +409,7 @@ size_t SequenceContainer::readFastq(std::vector<FastaRecord>& record,
 		while (!gzeof(fd))
 		{
 			//get a new line
+			size_t lineStart = gztell(fd);
 			for (;;)
 			{
 				char* read = gzgets(fd, rawBuffer, BUF_SIZE);
@@ -272,15 +432,15 @@ size_t SequenceContainer::readFastq(std::vector<FastaRecord>& record,
 
 			if (stateCounter == 0)
 			{
+				if (lineStart >= rangeEnd) break;
 				if (nextLine[0] != '@') throw ParseException("Fastq format error");
 				header = nextLine;
 				this->validateHeader(header);
 			}
 			else if (stateCounter == 1)
 			{
-				this->validateSequence(nextLine);
-				record.emplace_back(DnaSequence(nextLine), header, 
-									FastaRecord::ID_NONE);
+				addRecord(header, nextLine);
+				++numRecords;
 			}
 			else if (stateCounter == 2)
 			{
@@ -295,13 +455,20 @@ size_t SequenceContainer::readFastq(std::vector<FastaRecord>& record,
 	{
 		std::stringstream ss;
 		ss << "parse error in " << fileName << " on line " << lineNo << ": " << e.what();
+		delete[] rawBuffer;
 		gzclose(fd);
 		throw ParseException(ss.str());
 	}
+	catch (...)
+	{
+		delete[] rawBuffer;
+		gzclose(fd);
+		throw;
+	}
 
 	gzclose(fd);
 	delete[] rawBuffer;
-	return record.size();
+	return numRecords;
 }
 
 
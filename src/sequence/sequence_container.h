@@ -8,6 +8,7 @@
 #include <unordered_map>
 #include <string>
 #include <limits>
+#include <functional>
 
 #include "sequence.h"
 
@@ -44,6 +45,9 @@ struct FastaRecord
 		int signedId() const
 			{return (_id % 2) ? -((int)_id + 1) / 2 : (int)_id / 2 + 1;}
 
+		uint32_t rawId() const		//dense, could be used for array indexing
+			{return _id;}
+
 		friend std::ostream& operator << (std::ostream& stream, const Id& id)
 		{
 			stream << std::to_string(id._id);
@@ -153,7 +157,31 @@ public:
 	SequenceContainer():
 		_offsetInitialized(false) {}
 
-	void loadFromFile(const std::string& filename, int minReadLength = 0);
+	//Every added read is also passed to the callback as soon as it is 
+	//packed, so the reads could be processed (e.g. k-mers counted) 
+	//while the file is being read. The callback is called concurrently
+	//from the worker threads, and only for the forward strands
+	typedef std::function<void(const DnaSequence&)> SequenceCallback;
+	void loadFromFile(const std::string& filename, int minReadLength = 0,
+					  const SequenceCallback& onPacked = nullptr);
+
+	//the parsers pass each record (header and raw sequence) to the callback
+	typedef std::function<void(std::string& header, 
+							   std::string& sequence)> RecordCallback;
+
+	//parses the file without storing the sequences. If the range is
+	//given, only the records that start inside it are parsed, the range
+	//boundaries should be the record starts (as returned by splitFile)
+	size_t parseFile(const std::string& filename, 
+					 const RecordCallback& addRecord,
+					 size_t rangeStart = 0, 
+					 size_t rangeEnd = std::numeric_limits<size_t>::max());
+
+	//splits an uncompressed file into ranges of about chunkSize bytes 
+	//that start at record boundaries. Returns the range boundaries, 
+	//compressed files are not split
+	std::vector<size_t> splitFile(const std::string& filename, 
+								  size_t chunkSize);
 
 	static void writeFasta(const std::vector<FastaRecord>& records,
 						   const std::string& fileName,
@@ -216,6 +244,12 @@ public:
 		return _sequenceOffsets[seqId._id - _seqIdOffest].offset + position;
 	}
 
+	//upper bound for the global positions
+	size_t globalLength() const
+	{
+		return !_sequenceOffsets.empty() ? _sequenceOffsets.back().offset : 0;
+	}
+
 	const FastaRecord& recordByName(const std::string& name) const
 	{
 		return this->getRecord(_nameIndex.at(name));
@@ -248,11 +282,13 @@ private:
 
 	FastaRecord::Id addSequence(const FastaRecord& sequence);
 
-	size_t readFasta(std::vector<FastaRecord>& record, 
-				     const std::string& fileName);
+	size_t readFasta(const std::string& fileName, 
+					 const RecordCallback& addRecord,
+					 size_t rangeStart, size_t rangeEnd);
 
-	size_t readFastq(std::vector<FastaRecord>& record, 
-				     const std::string& fileName);
+	size_t readFastq(const std::string& fileName,
+					 const RecordCallback& addRecord,
+					 size_t rangeStart, size_t rangeEnd);
 
 	bool   isFasta(const std::string& fileName);
 
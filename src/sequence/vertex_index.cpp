@@ -8,6 +8,11 @@
 #include <algorithm>
 #include <queue>
 #include <cmath>
+#include <mutex>
+#include <deque>
+#include <numeric>
+#include <limits>
+#include <cstdio>
 
 #include "vertex_index.h"
 #include "../common/logger.h"
@@ -16,9 +21,49 @@
 #include "../common/memory_info.h"
 
 
+std::vector<FastaRecord::Id> VertexIndex::indexedSeqs() const
+{
+	std::vector<FastaRecord::Id> seqIds;
+	if (_indexedSeqs.empty())
+	{
+		for (const auto& seq : _seqContainer.iterSeqs())
+		{
+			seqIds.push_back(seq.id);
+		}
+		return seqIds;
+	}
+
+	for (const auto& seqId : _indexedSeqs)
+	{
+		seqIds.push_back(seqId);
+		seqIds.push_back(seqId.rc());
+	}
+	return seqIds;
+}
+
+namespace
+{
+	bool useFlatCounter()
+	{
+		const size_t MAX_FLAT_K = 17;
+		return Parameters::get().kmerSize <= MAX_FLAT_K;
+	}
+}
+
 void VertexIndex::countKmers()
 {
-	_kmerCounter.count(/*use flat counter*/ true);
+	_kmerCounter.count(useFlatCounter());
+}
+
+void VertexIndex::startCountingKmers()
+{
+	_kmerCounter.startCounting(useFlatCounter());
+}
+
+void VertexIndex::finishCountingKmers()
+{
+	if (_outputProgress) Logger::get().info() << "Counting k-mers";
+	_kmerCounter.finishCounting();
 }
 
 
@@ -29,10 +74,29 @@ void VertexIndex::buildIndexUnevenCoverage(int globalMinFreq, float selectRate,
 
 	//_solidMultiplier = 1;
 
-	std::vector<FastaRecord::Id> allReads;
-	for (const auto& seq : _seqContainer.iterSeqs())
+	std::vector<FastaRecord::Id> allReads = this->indexedSeqs();
+
+	if ((bool)Config::get("sort_based_index"))
 	{
-		allReads.push_back(seq.id);
+		std::function<std::vector<KmerPosition>(const FastaRecord::Id&)> 
+		yieldKmers = [this, globalMinFreq, selectRate, tandemFreq]
+			(const FastaRecord::Id& readId)
+		{
+			std::vector<KmerPosition> kmers;
+			for (auto kmerFreq : this->yieldFrequentKmers(readId, selectRate, 
+														  tandemFreq))
+			{
+				if (kmerFreq.freq < (size_t)globalMinFreq) continue;
+				kmers.emplace_back(kmerFreq.kmer, kmerFreq.position);
+			}
+			return kmers;
+		};
+		this->buildIndexSorted(yieldKmers, globalMinFreq, 
+							   (float)Config::get("repeat_kmer_rate"),
+							   /*filter by global freq*/ true);
+		if (!_globalRepeatCutoff) _kmerCounter.clear();
+		this->finalizeIndex();
+		return;
 	}
 
 	//first, count the number of k-mers that will be actually stored in the index
@@ -103,7 +167,7 @@ void VertexIndex::buildIndexUnevenCoverage(int globalMinFreq, float selectRate,
 	processInParallel(allReads, indexUpdate, 
 					  Parameters::get().numThreads, _outputProgress);
 
-	_kmerCounter.clear();
+	if (!_globalRepeatCutoff) _kmerCounter.clear();
 
 	Logger::get().debug() << "Sorting k-mer index";
 	for (const auto& kmerVec : _kmerIndex.lock_table())
@@ -122,6 +186,8 @@ void VertexIndex::buildIndexUnevenCoverage(int globalMinFreq, float selectRate,
 	Logger::get().debug() << "Index size: " << totalEntries;
 	Logger::get().debug() << "Mean k-mer index frequency: " 
 		<< (float)totalEntries / _kmerIndex.size();
+
+	this->finalizeIndex();
 }
 
 namespace
@@ -149,12 +215,14 @@ void VertexIndex::filterFrequentKmers(int minCoverage, float rate)
 		}
 	}
 	float meanFrequency = (float)totalKmers / (uniqueKmers + 1);
-	_repetitiveFrequency = rate * meanFrequency;
+	if (!_globalRepeatCutoff) _repetitiveFrequency = rate * meanFrequency;
 	
 	size_t repetitiveKmers = 0;
 	for (const auto& kmer : _kmerIndex.lock_table())
 	{
-		if (kmer.second.capacity > _repetitiveFrequency)
+		size_t freq = !_globalRepeatCutoff ? kmer.second.capacity : 
+											 _kmerCounter.getFreq(kmer.first);
+		if (freq > _repetitiveFrequency)
 		{
 			//++repetitiveKmers;
 			repetitiveKmers += kmer.second.capacity;
@@ -252,24 +320,73 @@ void VertexIndex::allocateIndexMemory()
 
 void VertexIndex::buildIndexMinimizers(int minCoverage, int wndLen)
 {
-	if (_outputProgress) Logger::get().info() << "Building minimizer index";
-
-	std::vector<FastaRecord::Id> allReads;
+	std::vector<FastaRecord::Id> allReads = this->indexedSeqs();
 	size_t totalLen = 0;
-	for (const auto& seq : _seqContainer.iterSeqs())
+	for (const auto& seqId : allReads)
+	{
+		if (seqId.strand()) totalLen += _seqContainer.seqLen(seqId);
+	}
+
+	//Syncmers could be used instead of minimizers. The s-mer size is
+	//chosen so that the syncmer density roughly matches the minimizer
+	//density for the given window (2 / (w + 1) vs. 1 / (k - s + 1))
+	std::function<std::vector<KmerPosition>(const DnaSequence&)> seqSeeds;
+	if ((bool)Config::get("use_syncmers") && wndLen > 1)
+	{
+		const int smerSize = std::max(1, (int)Parameters::get().kmerSize - 
+											 (wndLen - 1) / 2);
+		if (_outputProgress) Logger::get().info() << "Building syncmer index";
+		Logger::get().debug() << "Syncmer s-mer size: " << smerSize;
+		seqSeeds = [smerSize] (const DnaSequence& seq)
+		{
+			return yieldSyncmers(seq, smerSize);
+		};
+	}
+	else
+	{
+		if (_outputProgress) Logger::get().info() << "Building minimizer index";
+		seqSeeds = [wndLen] (const DnaSequence& seq)
+		{
+			return yieldMinimizers(seq, wndLen);
+		};
+	}
+
+	//the same seeds, but from the homopolymer-compressed sequences
+	_hpcSeeds = (bool)Config::get("hpc_seeding");
+	if (_hpcSeeds) Logger::get().debug() << "Using homopolymer-compressed seeds";
+	std::function<std::vector<KmerPosition>(const FastaRecord::Id&)> 
+	yieldSeeds = [this, &seqSeeds] (const FastaRecord::Id& readId)
 	{
-		allReads.push_back(seq.id);
-		if (seq.id.strand()) totalLen += seq.sequence.length();
+		return _hpcSeeds ? yieldHpcSeeds(_seqContainer.getSeq(readId), seqSeeds) :
+						   seqSeeds(_seqContainer.getSeq(readId));
+	};
+
+	if ((bool)Config::get("sort_based_index"))
+	{
+		this->buildIndexSorted(yieldSeeds, minCoverage, 
+							   (float)Config::get("repeat_kmer_rate"),
+							   /*filter by global freq*/ false);
+
+		size_t totalEntries = 0;
+		for (const auto& kmerRec : _kmerIndex.lock_table())
+		{
+			totalEntries += kmerRec.second.size;
+		}
+		_sampleRate = (float)totalLen / totalEntries;
+		Logger::get().debug() << "Minimizer rate: " << _sampleRate;
+		this->logSeedStatistics(yieldSeeds, allReads);
+		this->finalizeIndex();
+		return;
 	}
 
 	_kmerIndex.reserve(1000000);
 	if (_outputProgress) Logger::get().info() << "Pre-calculating index storage";
 	std::function<void(const FastaRecord::Id&)> initializeIndex = 
-	[this, minCoverage, wndLen] (const FastaRecord::Id& readId)
+	[this, &yieldSeeds] (const FastaRecord::Id& readId)
 	{
 		if (!readId.strand()) return;
 
-		auto minimizers = yieldMinimizers(_seqContainer.getSeq(readId), wndLen);
+		auto minimizers = yieldSeeds(readId);
 		for (auto kmerPos : minimizers)
 		{
 			auto stdKmer = kmerPos.kmer;
@@ -287,10 +404,10 @@ void VertexIndex::buildIndexMinimizers(int minCoverage, int wndLen)
 	
 	if (_outputProgress) Logger::get().info() << "Filling index";
 	std::function<void(const FastaRecord::Id&)> indexUpdate = 
-	[this, minCoverage, wndLen] (const FastaRecord::Id& readId)
+	[this, &yieldSeeds] (const FastaRecord::Id& readId)
 	{
 		if (!readId.strand()) return;
-		auto minimizers = yieldMinimizers(_seqContainer.getSeq(readId), wndLen);
+		auto minimizers = yieldSeeds(readId);
 		for (auto kmerPos : minimizers)
 		{
 			FastaRecord::Id targetRead = readId;
@@ -344,19 +461,456 @@ void VertexIndex::buildIndexMinimizers(int minCoverage, int wndLen)
 	float minimizerRate = (float)totalLen / totalEntries;
 	Logger::get().debug() << "Minimizer rate: " << minimizerRate;
 	_sampleRate = minimizerRate;
+
+	this->logSeedStatistics(yieldSeeds, allReads);
+	this->finalizeIndex();
+}
+
+//Seed density and spacing are estimated on a subset of the indexed
+//sequences. Seed recall is approximated by the fraction of indexed
+//seed occurrences that are shared between at least two positions 
+//(seeds that were not destroyed by sequencing errors)
+void VertexIndex::logSeedStatistics(std::function<std::vector<KmerPosition>
+										(const FastaRecord::Id&)> yieldSeeds,
+									const std::vector<FastaRecord::Id>& seqIds)
+{
+	const size_t MAX_SAMPLE = 1000;
+	std::vector<FastaRecord::Id> sample;
+	for (const auto& seqId : seqIds)
+	{
+		if (seqId.strand()) sample.push_back(seqId);
+	}
+	const size_t step = std::max((size_t)1, sample.size() / MAX_SAMPLE);
+
+	size_t sampleLen = 0;
+	size_t numSeeds = 0;
+	std::vector<int32_t> gaps;
+	for (size_t i = 0; i < sample.size(); i += step)
+	{
+		sampleLen += _seqContainer.seqLen(sample[i]);
+		auto seeds = yieldSeeds(sample[i]);
+		numSeeds += seeds.size();
+		for (size_t j = 1; j < seeds.size(); ++j)
+		{
+			gaps.push_back(seeds[j].position - seeds[j - 1].position);
+		}
+	}
+
+	size_t totalEntries = 0;
+	size_t sharedEntries = 0;
+	for (const auto& kmerRec : _kmerIndex.lock_table())
+	{
+		totalEntries += kmerRec.second.size;
+		if (kmerRec.second.size > 1) sharedEntries += kmerRec.second.size;
+	}
+
+	if (sampleLen == 0 || gaps.empty() || totalEntries == 0) return;
+	std::sort(gaps.begin(), gaps.end());
+	size_t sumGaps = 0;
+	for (auto gap : gaps) sumGaps += gap;
+
+	Logger::get().debug() << "Seed density: " << (float)numSeeds / sampleLen
+		<< ", mean gap: " << (float)sumGaps / gaps.size() << ", 99% gap: " 
+		<< gaps[gaps.size() * 99 / 100] << ", max gap: " << gaps.back();
+	Logger::get().debug() << "Seed recall (shared seeds): " 
+		<< (float)sharedEntries / totalEntries;
+}
+
+
+//Single-pass alternative to the hash-based construction above.
+//(k-mer, global position) pairs are extracted once into per-thread
+//buffers, which are partitioned by the top bits of the k-mer hash.
+//Then each partition is sorted independently (in parallel), which groups
+//the positions of each k-mer (already in the sorted order) and gives
+//the k-mer frequencies for the repeat cutoff. The result is the same
+//as produced by the two-pass construction.
+void VertexIndex::buildIndexSorted(std::function<std::vector<KmerPosition>
+										(const FastaRecord::Id&)> yieldKmers,
+								   int minCoverage, float rate, 
+								   bool filterByGlobalFreq)
+{
+	const int BUCKET_BITS = 10;
+	const size_t NUM_BUCKETS = 1 << BUCKET_BITS;
+	const size_t numThreads = Parameters::get().numThreads;
+
+	std::vector<FastaRecord::Id> allReads;
+	for (const auto& seqId : this->indexedSeqs())
+	{
+		if (seqId.strand()) allReads.push_back(seqId);
+	}
+
+	if (_outputProgress) Logger::get().info() << "Extracting k-mer positions";
+	std::vector<std::vector<std::vector<KmerIndexEntry>>> 
+		threadBuckets(numThreads, std::vector<std::vector<KmerIndexEntry>>(NUM_BUCKETS));
+	std::function<void(const FastaRecord::Id&, size_t)> extractKmers = 
+	[this, &yieldKmers, &threadBuckets] (const FastaRecord::Id& readId, 
+										 size_t threadId)
+	{
+		auto& buckets = threadBuckets[threadId];
+		for (auto kmerPos : yieldKmers(readId))
+		{
+			FastaRecord::Id targetRead = readId;
+			bool revCmp = kmerPos.kmer.standardForm();
+			if (revCmp)
+			{
+				kmerPos.position = _seqContainer.seqLen(readId) - 
+										kmerPos.position -
+										Parameters::get().kmerSize;
+				targetRead = targetRead.rc();
+			}
+
+			KmerIndexEntry entry;
+			entry.kmer = kmerPos.kmer.numRepr();
+			entry.pos.set(_seqContainer.globalPosition(targetRead, 
+													   kmerPos.position));
+			buckets[kmerPos.kmer.hash() >> (64 - BUCKET_BITS)].push_back(entry);
+		}
+	};
+	processInParallelThreaded(allReads, extractKmers, numThreads, 
+							  _outputProgress);
+
+	//merging per-thread parts of each bucket, then sorting
+	std::vector<size_t> bucketIds;
+	for (size_t i = 0; i < NUM_BUCKETS; ++i) bucketIds.push_back(i);
+	std::vector<std::vector<KmerIndexEntry>> buckets(NUM_BUCKETS);
+	std::atomic<size_t> totalKmers(0);
+	std::atomic<size_t> solidKmers(0);
+	std::atomic<size_t> uniqueKmers(0);
+
+	auto groupEnd = [](const std::vector<KmerIndexEntry>& bucket, size_t start)
+	{
+		size_t end = start + 1;
+		while (end < bucket.size() && bucket[end].kmer == bucket[start].kmer) ++end;
+		return end;
+	};
+
+	Logger::get().debug() << "Sorting k-mer index";
+	std::function<void(const size_t&)> sortBucket =
+	[&threadBuckets, &buckets, &totalKmers, &solidKmers, &uniqueKmers, 
+	 &groupEnd, minCoverage] (const size_t& bucketId)
+	{
+		size_t bucketSize = 0;
+		for (auto& parts : threadBuckets) bucketSize += parts[bucketId].size();
+
+		auto& bucket = buckets[bucketId];
+		bucket.reserve(bucketSize);
+		for (auto& parts : threadBuckets)
+		{
+			bucket.insert(bucket.end(), parts[bucketId].begin(), 
+						  parts[bucketId].end());
+			std::vector<KmerIndexEntry>().swap(parts[bucketId]);
+		}
+		std::sort(bucket.begin(), bucket.end(),
+				  [](const KmerIndexEntry& e1, const KmerIndexEntry& e2)
+				  {
+				  	  if (e1.kmer != e2.kmer) return e1.kmer < e2.kmer;
+					  return e1.pos.get() < e2.pos.get();
+				  });
+
+		size_t localTotal = 0;
+		size_t localSolid = 0;
+		size_t localUnique = 0;
+		for (size_t start = 0; start < bucket.size(); )
+		{
+			size_t end = groupEnd(bucket, start);
+			if (end - start >= (size_t)minCoverage)
+			{
+				localTotal += end - start;
+				++localSolid;
+			}
+			++localUnique;
+			start = end;
+		}
+		totalKmers += localTotal;
+		solidKmers += localSolid;
+		uniqueKmers += localUnique;
+	};
+	processInParallel(bucketIds, sortBucket, numThreads, false);
+	threadBuckets.clear();
+
+	//same cutoff as in filterFrequentKmers()
+	float meanFrequency = (float)totalKmers / (solidKmers + 1);
+	if (!_globalRepeatCutoff) _repetitiveFrequency = rate * meanFrequency;
+
+	//Filling the index. Each bucket gets its own memory chunk,
+	//padded the same way as in allocateIndexMemory()
+	const size_t PADDING = 1;
+	_kmerIndex.reserve(uniqueKmers);
+	std::mutex chunksLock;
+	std::atomic<size_t> repetitiveKmers(0);
+	std::function<void(const size_t&)> fillBucket =
+	[this, &buckets, &groupEnd, &chunksLock, &repetitiveKmers,
+	 PADDING, filterByGlobalFreq] (const size_t& bucketId)
+	{
+		auto& bucket = buckets[bucketId];
+		if (bucket.empty()) return;
+
+		size_t chunkSize = 0;
+		for (size_t start = 0; start < bucket.size(); )
+		{
+			size_t end = groupEnd(bucket, start);
+			if (end - start <= _repetitiveFrequency) 
+			{
+				chunkSize += end - start + PADDING;
+			}
+			start = end;
+		}
+		IndexChunk* chunk = new IndexChunk[chunkSize];
+		{
+			std::lock_guard<std::mutex> lock(chunksLock);
+			_memoryChunks.push_back(chunk);
+		}
+
+		size_t chunkOffset = 0;
+		for (size_t start = 0; start < bucket.size(); )
+		{
+			size_t end = groupEnd(bucket, start);
+			Kmer kmer(bucket[start].kmer);
+			size_t freq = !_globalRepeatCutoff ? end - start : 
+												 _kmerCounter.getFreq(kmer);
+			if (freq > _repetitiveFrequency)
+			{
+				repetitiveKmers += end - start;
+				_repetitiveKmers.insert(kmer, true);
+			}
+			else if (!filterByGlobalFreq || 
+					 _kmerCounter.getFreq(kmer) <= _repetitiveFrequency)
+			{
+				ReadVector rv(end - start, end - start);
+				rv.data = chunk + chunkOffset;
+				for (size_t i = start; i < end; ++i)
+				{
+					rv.data[i - start] = bucket[i].pos;
+				}
+				chunkOffset += end - start + PADDING;
+				_kmerIndex.insert(kmer, rv);
+			}
+			start = end;
+		}
+		std::vector<KmerIndexEntry>().swap(bucket);
+	};
+	processInParallel(bucketIds, fillBucket, numThreads, false);
+
+	size_t totalEntries = 0;
+	for (const auto& kmerRec : _kmerIndex.lock_table())
+	{
+		totalEntries += kmerRec.second.size;
+	}
+	Logger::get().debug() << "Mean k-mer frequency: " << meanFrequency;
+	Logger::get().debug() << "Repetitive k-mer frequency: " 
+						  << _repetitiveFrequency;
+	Logger::get().debug() << "Filtered " << repetitiveKmers 
+						  << " repetitive k-mers (" 
+						  << (float)repetitiveKmers / totalKmers << ")";
+	Logger::get().debug() << "Selected k-mers: " << _kmerIndex.size();
+	Logger::get().debug() << "K-mer index size: " << totalEntries;
+}
+
+namespace
+{
+	//Elias-Fano encoding parameter: the number of lower bits of each
+	//position that are stored explicitly. It only depends on the list
+	//size and the universe, so it does not need to be stored
+	int efLowBits(size_t universe, size_t listSize)
+	{
+		size_t ratio = universe / listSize;
+		return ratio > 1 ? 63 - __builtin_clzll(ratio) : 0;
+	}
+
+	//reads a word starting from the given bit. Only the lower
+	//64 - bitOffset % 8 bits are valid, the rest are zero
+	inline uint64_t loadBits(const uint8_t* data, size_t bitOffset)
+	{
+		uint64_t word;
+		memcpy(&word, data + bitOffset / 8, sizeof(word));
+		return word >> (bitOffset % 8);
+	}
+
+	inline void setBit(uint8_t* data, size_t bitOffset)
+	{
+		data[bitOffset / 8] |= 1 << (bitOffset % 8);
+	}
 }
 
+void VertexIndex::finalizeIndex()
+{
+	if ((bool)Config::get("compressed_index")) this->compressIndex();
+}
+
+//Converts the sorted position lists into the Elias-Fano representation.
+//For a list of n positions, the lower L = log(U / n) bits of each position 
+//are stored explicitly (n * L bits), followed by the higher parts, encoded 
+//in unary as a bit vector where the i-th position sets bit (high_i + i). 
+//This takes at most n * (L + 2) bits per list instead of 40 bits per position.
+void VertexIndex::compressIndex()
+{
+	const size_t universe = _seqContainer.globalLength();
+	const size_t PACKED_CHUNK = 32 * 1024 * 1024;
+	//decoding reads whole words, so the chunks are padded
+	const size_t PADDING = sizeof(uint64_t);
+
+	size_t totalPositions = 0;
+	size_t packedBytes = 0;
+	uint8_t* chunk = nullptr;
+	size_t chunkSize = 0;
+	size_t chunkOffset = 0;
+	for (auto& kmerRec : _kmerIndex.lock_table())
+	{
+		ReadVector& rv = kmerRec.second;
+		if (rv.size == 0)
+		{
+			rv.packed = nullptr;
+			continue;
+		}
+
+		const int lowBits = efLowBits(universe, rv.size);
+		const size_t highOffset = rv.size * lowBits;
+		const size_t numBits = highOffset + rv.size + 
+							   (rv.data[rv.size - 1].get() >> lowBits);
+		const size_t numBytes = (numBits + 7) / 8;
+		if (chunkSize - chunkOffset < numBytes + PADDING)
+		{
+			chunkSize = std::max(PACKED_CHUNK, numBytes + PADDING);
+			chunk = new uint8_t[chunkSize]();
+			_packedChunks.push_back(chunk);
+			chunkOffset = 0;
+		}
+		uint8_t* packed = chunk + chunkOffset;
+		chunkOffset += numBytes;
+
+		for (size_t i = 0; i < rv.size; ++i)
+		{
+			size_t globPos = rv.data[i].get();
+			assert(i == 0 || rv.data[i - 1].get() <= globPos);
+			for (int b = 0; b < lowBits; ++b)
+			{
+				if ((globPos >> b) & 1) setBit(packed, i * lowBits + b);
+			}
+			setBit(packed, highOffset + (globPos >> lowBits) + i);
+		}
+		rv.packed = packed;
+		rv.capacity = 0;
+
+		totalPositions += rv.size;
+		packedBytes += numBytes;
+	}
+
+	for (auto& chunk : _memoryChunks) delete[] chunk;
+	_memoryChunks.clear();
+	_compressed = true;
+
+	Logger::get().debug() << "Compressed index: " << packedBytes / 1024 / 1024
+		<< " Mb, " << (float)packedBytes * 8 / (totalPositions + 1)
+		<< " bits per position";
+}
+
+size_t VertexIndex::decodeKmerPos(Kmer kmer, 
+								  std::vector<ReadPosition>& out) const
+{
+	out.clear();
+	bool revComp = kmer.standardForm();
+	ReadVector rv;
+	if (!_kmerIndex.find(kmer, rv) || rv.size == 0) return 0;
+	out.reserve(rv.size);
+
+	//positions are sorted, so the consecutive hits from the same
+	//sequence are converted without searching for it again
+	const int32_t kmerSize = Parameters::get().kmerSize;
+	FastaRecord::Id seqId;
+	int32_t seqPos = 0;
+	int32_t seqLen = 0;
+	size_t seqStart = 0;
+	size_t seqEnd = 0;
+	auto addPosition = [&](size_t globPos)
+	{
+		if (globPos < seqStart || globPos >= seqEnd)
+		{
+			_seqContainer.seqPosition(globPos, seqId, seqPos, seqLen);
+			seqStart = globPos - seqPos;
+			seqEnd = seqStart + seqLen;
+		}
+		int32_t position = globPos - seqStart;
+		if (!revComp)
+		{
+			out.emplace_back(seqId, position);
+		}
+		else
+		{
+			out.emplace_back(seqId.rc(), seqLen - position - kmerSize);
+		}
+	};
+
+	if (!_compressed)
+	{
+		for (size_t i = 0; i < rv.size; ++i) addPosition(rv.data[i].get());
+		return rv.size;
+	}
+
+	const int lowBits = efLowBits(_seqContainer.globalLength(), rv.size);
+	const uint64_t lowMask = (1ULL << lowBits) - 1;
+	const size_t highOffset = rv.size * lowBits;
+	size_t bitPos = highOffset;
+	for (size_t i = 0; i < rv.size; ++i)
+	{
+		//next set bit of the higher parts
+		uint64_t word = loadBits(rv.packed, bitPos);
+		while (!word)
+		{
+			bitPos += 64 - bitPos % 8;
+			word = loadBits(rv.packed, bitPos);
+		}
+		bitPos += __builtin_ctzll(word);
+
+		size_t high = bitPos - highOffset - i;
+		size_t low = loadBits(rv.packed, i * lowBits) & lowMask;
+		addPosition((high << lowBits) | low);
+		++bitPos;
+	}
+	return rv.size;
+}
 
 void VertexIndex::clear()
+{
+	_globalRepeatCutoff = false;
+	this->clearIndex();
+	//_kmerCounts.reserve(0);
+}
+
+void VertexIndex::clearIndex()
 {
 	for (auto& chunk : _memoryChunks) delete[] chunk;
 	_memoryChunks.clear();
+	for (auto& chunk : _packedChunks) delete[] chunk;
+	_packedChunks.clear();
+	_compressed = false;
+	_hpcSeeds = false;
 
 	_kmerIndex.clear();
 	_kmerIndex.reserve(0);
 
-	_kmerCounter.clear();
-	//_kmerCounts.reserve(0);
+	if (!_globalRepeatCutoff) _kmerCounter.clear();
+}
+
+//The cutoff is computed the same way as in filterFrequentKmers(), but
+//from the global counts of all solid k-mers (the k-mers selected for
+//the index are not known before it is built), so it is somewhat higher
+void VertexIndex::setGlobalRepeatCutoff(int minCoverage, float rate)
+{
+	size_t totalKmers = 0;
+	size_t solidKmers = 0;
+	for (const auto& freqCount : _kmerCounter.getKmerHist())
+	{
+		if (freqCount.first < (size_t)minCoverage) continue;
+		totalKmers += freqCount.first * freqCount.second;
+		solidKmers += freqCount.second;
+	}
+	float meanFrequency = (float)totalKmers / (solidKmers + 1);
+	_repetitiveFrequency = rate * meanFrequency;
+	_globalRepeatCutoff = true;
+
+	Logger::get().debug() << "Global mean k-mer frequency: " << meanFrequency;
+	Logger::get().debug() << "Global repetitive k-mer frequency: " 
+						  << _repetitiveFrequency;
 }
 
 
@@ -365,72 +919,101 @@ void KmerCounter::count(bool useFlatCounter)
 	//Logger::get().debug() << "Before counter: " 
 	//	<< getPeakRSS() / 1024 / 1024 / 1024 << " Gb";
 
+	this->startCounting(useFlatCounter);
+	if (_outputProgress) Logger::get().info() << "Counting k-mers:";
+	std::function<void(const FastaRecord::Id&)> readUpdate = 
+	[this] (const FastaRecord::Id& readId)
+	{
+		this->addSequence(_seqContainer.getSeq(readId));
+	};
+	std::vector<FastaRecord::Id> allReads;
+	for (const auto& seq : _seqContainer.iterSeqs())
+	{
+		if (seq.id.strand()) allReads.push_back(seq.id);
+	}
+	processInParallel(allReads, readUpdate, Parameters::get().numThreads, _outputProgress);
+	this->finishCounting();
+
+	//Logger::get().debug() << "After counter: " 
+	//	<< getPeakRSS() / 1024 / 1024 / 1024 << " Gb";
+}
+
+void KmerCounter::startCounting(bool useFlatCounter)
+{
 	if (useFlatCounter && Parameters::get().kmerSize > 17)
 	{
 		throw std::runtime_error("Can't use flat counter for k-mer size > 17");
 	}
 	_useFlatCounter = useFlatCounter;
+	if (!useFlatCounter)
+	{
+		this->startBucketed();
+		return;
+	}
 
 	//flat array for all possible k-mers, 4 bits for each
 	//in case of k=17, takes 8Gb
-	static const size_t COUNTER_LEN = std::pow(4, Parameters::get().kmerSize) / 2;
-	if (useFlatCounter)
+	const size_t counterLen = std::pow(4, Parameters::get().kmerSize) / 2;
+	_flatCounter = new std::atomic<uint8_t>[counterLen];
+	std::memset(_flatCounter, 0, counterLen);
+}
+
+void KmerCounter::addSequence(const DnaSequence& sequence)
+{
+	if (_useBucketCounter)
 	{
-		_flatCounter = new std::atomic<uint8_t>[COUNTER_LEN];
-		std::memset(_flatCounter, 0, COUNTER_LEN);
+		this->splitSequence(sequence);
+		return;
 	}
- 
-	if (_outputProgress) Logger::get().info() << "Counting k-mers:";
-	std::function<void(const FastaRecord::Id&)> readUpdate = 
-	[this] (const FastaRecord::Id& readId)
+
+	for (auto kmerPos : IterKmers(sequence))
 	{
-		if (!readId.strand()) return;
-		
-		for (auto kmerPos : IterKmers(_seqContainer.getSeq(readId)))
+		kmerPos.kmer.standardForm();
+		bool addOne = true;
+		if (_useFlatCounter)
 		{
-			kmerPos.kmer.standardForm();
-			bool addOne = true;
-			if (_useFlatCounter)
-			{
-				size_t arrayPos = kmerPos.kmer.numRepr() / 2;
-				bool highBits = kmerPos.kmer.numRepr() % 2;
+			size_t arrayPos = kmerPos.kmer.numRepr() / 2;
+			bool highBits = kmerPos.kmer.numRepr() % 2;
 
-				while (true)
+			while (true)
+			{
+				uint8_t expected = _flatCounter[arrayPos]; 
+				uint8_t count = highBits ? (expected >> 4) : (expected & 15);
+				if (count == 15)
 				{
-					uint8_t expected = _flatCounter[arrayPos]; 
-					uint8_t count = highBits ? (expected >> 4) : (expected & 15);
-					if (count == 15)
-					{
-						break;
-					}
+					break;
+				}
 
-					uint8_t updated = highBits ? (expected + 16) : (expected + 1);
-					if (_flatCounter[arrayPos].compare_exchange_weak(expected,  updated))
-					{
-						if (count == 0) ++_numKmers;
-						addOne = false; //not saturated yet, don't update hash counter
-						break;
-					}
+				uint8_t updated = highBits ? (expected + 16) : (expected + 1);
+				if (_flatCounter[arrayPos].compare_exchange_weak(expected,  updated))
+				{
+					if (count == 0) ++_numKmers;
+					addOne = false; //not saturated yet, don't update hash counter
+					break;
 				}
 			}
+		}
 
-			if (addOne)
-			{
-				_hashCounter.upsert(kmerPos.kmer, [](size_t& num){++num;}, 1);
-			}
+		if (addOne)
+		{
+			_hashCounter.upsert(kmerPos.kmer, [](size_t& num){++num;}, 1);
 		}
-	};
-	std::vector<FastaRecord::Id> allReads;
-	for (const auto& seq : _seqContainer.iterSeqs())
+	}
+}
+
+void KmerCounter::finishCounting()
+{
+	if (_useBucketCounter)
 	{
-		allReads.push_back(seq.id);
+		this->countBuckets();
+		return;
 	}
-	processInParallel(allReads, readUpdate, Parameters::get().numThreads, _outputProgress);
 
 	Logger::get().debug() << "Updating k-mer histogram";
 	if (_useFlatCounter)
 	{
-		for (size_t kmerId = 0; kmerId < COUNTER_LEN * 2; ++kmerId)
+		const size_t counterLen = std::pow(4, Parameters::get().kmerSize) / 2;
+		for (size_t kmerId = 0; kmerId < counterLen * 2; ++kmerId)
 		{
 			Kmer kmer(kmerId);
 			size_t freq = this->getFreq(kmer);
@@ -446,18 +1029,298 @@ void KmerCounter::count(bool useFlatCounter)
 		}
 	}
 
-	//Logger::get().debug() << "After counter: " 
-	//	<< getPeakRSS() / 1024 / 1024 / 1024 << " Gb";
-
 	Logger::get().debug() << "Hash size: " << _hashCounter.size();
 	Logger::get().debug() << "Total k-mers " << _numKmers;
 }
 
 
+namespace
+{
+	const size_t NUM_KMER_BUCKETS = 4096;
+
+	//hash of the canonical signature m-mer
+	inline size_t signatureHash(size_t fwdRepr, size_t revRepr)
+	{
+		size_t z = std::min(fwdRepr, revRepr) + 0x9E3779B97F4A7C15ULL;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	size_t signatureLength()
+	{
+		const size_t SIGNATURE_LEN = 9;
+		return std::min(SIGNATURE_LEN, (size_t)Parameters::get().kmerSize);
+	}
+}
+
+//The minimal canonical m-mer hash within the k-mer. It does not
+//depend on the k-mer strand, so the buckets are consistent
+size_t KmerCounter::bucketId(Kmer kmer) const
+{
+	const size_t kmerSize = Parameters::get().kmerSize;
+	const size_t sigLen = signatureLength();
+	const size_t sigMask = (1ULL << (2 * sigLen)) - 1;
+
+	Kmer::KmerRepr fwdRepr = kmer.numRepr();
+	Kmer::KmerRepr revRepr = kmer.reverseComplement().numRepr();
+	size_t minHash = std::numeric_limits<size_t>::max();
+	for (size_t i = 0; i + sigLen <= kmerSize; ++i)
+	{
+		size_t fwdSig = (fwdRepr >> (2 * (kmerSize - sigLen - i))) & sigMask;
+		size_t revSig = (revRepr >> (2 * i)) & sigMask;
+		minHash = std::min(minHash, signatureHash(fwdSig, revSig));
+	}
+	return minHash % NUM_KMER_BUCKETS;
+}
+
+std::string KmerCounter::bucketPath(size_t bucketId) const
+{
+	return _tempDir + "/kmer_bucket_" + std::to_string(bucketId) + ".bin";
+}
+
+void KmerCounter::startBucketed()
+{
+	_useBucketCounter = true;
+
+	//bucket files are only opened for appending the buffered
+	//records, as there are too many of them to keep open
+	if (!_tempDir.empty())
+	{
+		for (size_t i = 0; i < NUM_KMER_BUCKETS; ++i) 
+		{
+			std::remove(this->bucketPath(i).c_str());
+		}
+	}
+	_memBuckets.assign(NUM_KMER_BUCKETS, {});
+	std::vector<std::mutex>(NUM_KMER_BUCKETS).swap(_bucketLocks);
+	_bufferSets.clear();
+	_freeBufferSets.clear();
+}
+
+void KmerCounter::flushBuffer(size_t bucketId, std::vector<uint8_t>& buffer)
+{
+	if (buffer.empty()) return;
+	std::lock_guard<std::mutex> lock(_bucketLocks[bucketId]);
+	if (!_tempDir.empty())
+	{
+		FILE* fout = fopen(this->bucketPath(bucketId).c_str(), "ab");
+		if (!fout) throw std::runtime_error("Can't open " + 
+											this->bucketPath(bucketId));
+		size_t written = fwrite(buffer.data(), 1, buffer.size(), fout);
+		fclose(fout);
+		if (written != buffer.size())
+		{
+			throw std::runtime_error("Error writing " + this->bucketPath(bucketId));
+		}
+	}
+	else
+	{
+		_memBuckets[bucketId].insert(_memBuckets[bucketId].end(),
+									 buffer.begin(), buffer.end());
+	}
+	buffer.clear();
+}
+
+//first pass: the sequence is split into super k-mers, stored
+//as (length, nucleotides) records in the corresponding buckets
+void KmerCounter::splitSequence(const DnaSequence& seq)
+{
+	const size_t kmerSize = Parameters::get().kmerSize;
+	const size_t sigLen = signatureLength();
+	const size_t sigMask = (1ULL << (2 * sigLen)) - 1;
+	const size_t FLUSH_SIZE = 64 * 1024;
+
+	//same k-mers as reported by IterKmers, which
+	//stops before the last k-mer of the sequence
+	const size_t seqLen = seq.length() - 1;
+	if (seq.length() <= kmerSize) return;
+
+	//the buffers are borrowed for the whole sequence, so 
+	//the concurrent calls never write into the same ones
+	std::vector<std::vector<uint8_t>>* buffers = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(_buffersLock);
+		if (_freeBufferSets.empty())
+		{
+			_bufferSets.emplace_back(NUM_KMER_BUCKETS);
+			_freeBufferSets.push_back(&_bufferSets.back());
+		}
+		buffers = _freeBufferSets.back();
+		_freeBufferSets.pop_back();
+	}
+
+	thread_local std::vector<size_t> sigHashes;
+	thread_local std::deque<size_t> minQueue;
+	sigHashes.clear();
+	minQueue.clear();
+	size_t fwdSig = 0;
+	size_t revSig = 0;
+	for (size_t i = 0; i < seqLen; ++i)
+	{
+		size_t nucl = seq.atRaw(i);
+		fwdSig = ((fwdSig << 2) | nucl) & sigMask;
+		revSig = (revSig >> 2) | ((3 - nucl) << (2 * (sigLen - 1)));
+		if (i + 1 >= sigLen) sigHashes.push_back(signatureHash(fwdSig, revSig));
+	}
+
+	auto writeSuperKmer = [&](size_t bucketId, size_t start, size_t end)
+	{
+		auto& buffer = (*buffers)[bucketId];
+		uint32_t length = end - start;
+		const uint8_t* lenBytes = reinterpret_cast<const uint8_t*>(&length);
+		buffer.insert(buffer.end(), lenBytes, lenBytes + sizeof(length));
+		for (size_t i = start; i < end; ++i) buffer.push_back(seq.atRaw(i));
+		if (buffer.size() > FLUSH_SIZE) this->flushBuffer(bucketId, buffer);
+	};
+
+	//sliding window minimum over the signatures of each k-mer
+	const size_t window = kmerSize - sigLen + 1;
+	size_t curBucket = 0;
+	size_t superStart = 0;
+	for (size_t i = 0; i < sigHashes.size(); ++i)
+	{
+		while (!minQueue.empty() && sigHashes[minQueue.back()] > sigHashes[i])
+		{
+			minQueue.pop_back();
+		}
+		minQueue.push_back(i);
+		if (i + 1 < window) continue;
+
+		size_t kmerStart = i + 1 - window;
+		while (minQueue.front() < kmerStart) minQueue.pop_front();
+		size_t bucketId = sigHashes[minQueue.front()] % NUM_KMER_BUCKETS;
+		if (kmerStart == 0)
+		{
+			curBucket = bucketId;
+		}
+		else if (bucketId != curBucket)
+		{
+			writeSuperKmer(curBucket, superStart, kmerStart - 1 + kmerSize);
+			curBucket = bucketId;
+			superStart = kmerStart;
+		}
+	}
+	writeSuperKmer(curBucket, superStart, seqLen);
+
+	std::lock_guard<std::mutex> lock(_buffersLock);
+	_freeBufferSets.push_back(buffers);
+}
+
+//second pass: each bucket is counted independently
+void KmerCounter::countBuckets()
+{
+	const size_t kmerSize = Parameters::get().kmerSize;
+	const Kmer::KmerRepr kmerMask = Kmer::kmerMask(kmerSize);
+	const size_t numThreads = Parameters::get().numThreads;
+	const bool onDisk = !_tempDir.empty();
+
+	for (auto& buffers : _bufferSets)
+	{
+		for (size_t i = 0; i < NUM_KMER_BUCKETS; ++i) 
+		{
+			this->flushBuffer(i, buffers[i]);
+		}
+	}
+	_bufferSets.clear();
+	_freeBufferSets.clear();
+
+	if (_outputProgress) Logger::get().info() << "Counting k-mer buckets:";
+	_bucketCounts.assign(NUM_KMER_BUCKETS, {});
+	std::mutex histLock;
+	std::vector<size_t> bucketIds(NUM_KMER_BUCKETS);
+	std::iota(bucketIds.begin(), bucketIds.end(), 0);
+	std::function<void(const size_t&)> countBucket = 
+	[&] (const size_t& bucketId)
+	{
+		std::vector<uint8_t> records;
+		if (onDisk)
+		{
+			FILE* fin = fopen(this->bucketPath(bucketId).c_str(), "rb");
+			if (!fin) return;	//empty bucket
+			fseek(fin, 0, SEEK_END);
+			records.resize(ftell(fin));
+			fseek(fin, 0, SEEK_SET);
+			if (fread(records.data(), 1, records.size(), fin) != records.size())
+			{
+				throw std::runtime_error("Error reading " + 
+										 this->bucketPath(bucketId));
+			}
+			fclose(fin);
+			std::remove(this->bucketPath(bucketId).c_str());
+		}
+		else
+		{
+			records.swap(_memBuckets[bucketId]);
+		}
+
+		std::vector<Kmer::KmerRepr> kmers;
+		size_t offset = 0;
+		while (offset < records.size())
+		{
+			uint32_t length = 0;
+			memcpy(&length, records.data() + offset, sizeof(length));
+			offset += sizeof(length);
+
+			Kmer kmer;
+			for (size_t i = 0; i < length; ++i)
+			{
+				kmer.appendRight(records[offset + i], kmerMask);
+				if (i + 1 < kmerSize) continue;
+				Kmer stdKmer = kmer;
+				stdKmer.standardForm();
+				kmers.push_back(stdKmer.numRepr());
+			}
+			offset += length;
+		}
+		std::vector<uint8_t>().swap(records);
+		std::sort(kmers.begin(), kmers.end());
+
+		KmerDistribution localHist;
+		size_t distinctKmers = 0;
+		auto& counts = _bucketCounts[bucketId];
+		for (size_t start = 0; start < kmers.size(); )
+		{
+			size_t end = start + 1;
+			while (end < kmers.size() && kmers[end] == kmers[start]) ++end;
+			localHist[end - start] += 1;
+			++distinctKmers;
+			if (end - start > 1) counts.push_back({kmers[start], 
+												   (uint32_t)(end - start)});
+			start = end;
+		}
+		counts.shrink_to_fit();
+
+		_numKmers += distinctKmers;
+		std::lock_guard<std::mutex> lock(histLock);
+		for (const auto& freqCount : localHist)
+		{
+			_kmerDistribution[freqCount.first] += freqCount.second;
+		}
+	};
+	processInParallel(bucketIds, countBucket, numThreads, _outputProgress);
+	std::vector<std::vector<uint8_t>>().swap(_memBuckets);
+
+	size_t storedKmers = 0;
+	for (const auto& counts : _bucketCounts) storedKmers += counts.size();
+	Logger::get().debug() << "Total k-mers " << _numKmers;
+	Logger::get().debug() << "Stored non-unique k-mers " << storedKmers;
+}
+
 size_t KmerCounter::getFreq(Kmer kmer) const
 {
 	//kmer.standardForm();
 
+	if (_useBucketCounter)
+	{
+		const auto& counts = _bucketCounts[this->bucketId(kmer)];
+		auto it = std::lower_bound(counts.begin(), counts.end(), kmer.numRepr(),
+								   [](const CountedKmer& ck, Kmer::KmerRepr repr)
+								   {return ck.kmer < repr;});
+		if (it != counts.end() && it->kmer == kmer.numRepr()) return it->count;
+		return 0;
+	}
+
 	size_t addCount = 0;
 	if (_useFlatCounter)
 	{
@@ -483,6 +1346,8 @@ void KmerCounter::clear()
 {
 	_hashCounter.clear();
 	_hashCounter.reserve(0);
+	std::vector<std::vector<CountedKmer>>().swap(_bucketCounts);
+	_useBucketCounter = false;
 	if (_flatCounter)
 	{
 		delete[] _flatCounter;
@@ -492,6 +1357,6 @@ void KmerCounter::clear()
 
 size_t KmerCounter::getKmerNum() const
 {
-	if (!_useFlatCounter) return _hashCounter.size();
+	if (!_useFlatCounter && !_useBucketCounter) return _hashCounter.size();
 	return _numKmers;
 }
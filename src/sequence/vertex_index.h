@@ -11,6 +11,9 @@
 #include <vector>
 #include <iostream>
 #include <cstring>
+#include <functional>
+#include <mutex>
+#include <deque>
 
 #include <cuckoohash_map.hh>
 
@@ -27,6 +30,7 @@ class KmerCounter
 public:
 	KmerCounter(const SequenceContainer& seqContainer):
 		_seqContainer(seqContainer), 
+		_useBucketCounter(false),
 		_flatCounter(nullptr), _numKmers(0)
 	{}
 
@@ -45,15 +49,51 @@ public:
 	}
 
 	void   count(bool useFlatCounter);
+	//The same counting split into steps, so the sequences could be
+	//passed as they are loaded. addSequence is thread-safe and expects
+	//each forward strand once; the counts are ready after finishCounting
+	void   startCounting(bool useFlatCounter);
+	void   addSequence(const DnaSequence& sequence);
+	void   finishCounting();
 	size_t getFreq(Kmer kmer) const;
 	size_t getKmerNum() const;
 	void clear();
 	void setOutputProgress(bool progress) {_outputProgress = progress;}
+	void setTempDirectory(const std::string& dir) {_tempDir = dir;}
 
 private:
+	//Counter for the larger k-mers that do not fit into the flat array.
+	//K-mers are split into buckets by their minimizer signature, so the
+	//consecutive k-mers of a read are stored together (as a super k-mer).
+	//Each bucket is then counted independently by sorting. Buckets
+	//are kept on disk if the temporary directory is set
+	void   startBucketed();
+	void   splitSequence(const DnaSequence& sequence);
+	void   countBuckets();
+	void   flushBuffer(size_t bucketId, std::vector<uint8_t>& buffer);
+	size_t bucketId(Kmer kmer) const;
+	std::string bucketPath(size_t bucketId) const;
+
+	struct CountedKmer
+	{
+		Kmer::KmerRepr kmer;
+		uint32_t count;
+	} __attribute__((packed));
+
 	const SequenceContainer& 	_seqContainer;
 	bool _outputProgress;
 	bool _useFlatCounter;
+	bool _useBucketCounter;
+	std::string _tempDir;
+	//only k-mers that occur more than once are stored
+	std::vector<std::vector<CountedKmer>> _bucketCounts;
+	//super k-mers between the two passes (if not on disk), and the
+	//per-thread write buffers, reused by the concurrent addSequence calls
+	std::vector<std::vector<uint8_t>> _memBuckets;
+	std::vector<std::mutex> _bucketLocks;
+	std::deque<std::vector<std::vector<uint8_t>>> _bufferSets;
+	std::vector<std::vector<std::vector<uint8_t>>*> _freeBufferSets;
+	std::mutex _buffersLock;
 
 	std::atomic<uint8_t>*			_flatCounter;
 	//std::vector<std::atomic<char>>  _flatCounter;
@@ -72,8 +112,8 @@ public:
 	}
 	VertexIndex(const SequenceContainer& seqContainer):
 		_seqContainer(seqContainer), _outputProgress(false), 
-		_sampleRate(1.0f), _repetitiveFrequency(0),
-		_kmerCounter(seqContainer)
+		_sampleRate(1.0f), _repetitiveFrequency(0), _globalRepeatCutoff(false),
+		_compressed(false), _hpcSeeds(false), _kmerCounter(seqContainer)
 		//_solidMultiplier(1)
 		//_flankRepeatSize(flankRepeatSize)
 	{}
@@ -115,113 +155,69 @@ private:
 
 	//static const size_t MAX_INDEX = 1ULL << (sizeof(IndexChunk) * 8);
 
-	struct ReadPosition
+	//(k-mer, global position) pair, used by the sort-based construction
+	struct KmerIndexEntry
 	{
-		ReadPosition(FastaRecord::Id readId = FastaRecord::ID_NONE, 
-					 int32_t position = 0):
-			readId(readId), position(position) {}
-		FastaRecord::Id readId;
-		int32_t position;
-	};
+		Kmer::KmerRepr kmer;
+		IndexChunk pos;
+	} __attribute__((packed));
 
+	//In the compressed index, capacity is not used, and the positions
+	//are stored as an Elias-Fano encoded bit stream (see compressIndex())
 	struct ReadVector
 	{
 		ReadVector(uint32_t capacity = 0, uint32_t size = 0): 
 			capacity(capacity), size(size), data(nullptr) {}
 		uint32_t capacity;
 		uint32_t size;
-		IndexChunk* data;
+		union
+		{
+			IndexChunk* data;
+			uint8_t* 	packed;
+		};
 	};
 
 public:
 	typedef std::map<size_t, size_t> KmerDistribution;
 
-	class KmerPosIterator
-	{
-	public:
-		KmerPosIterator(ReadVector rv, size_t index, bool revComp, 
-						const SequenceContainer& seqContainer):
-			rv(rv), index(index), revComp(revComp), 
-			seqContainer(seqContainer), kmerSize(Parameters::get().kmerSize) 
-		{}
-
-		bool operator==(const KmerPosIterator& other) const
-		{
-			return index == other.index && rv.data == other.rv.data;
-		}
-		bool operator!=(const KmerPosIterator& other) const
-		{
-			return !(*this == other);
-		}
-
-		//__attribute__((always_inline))
-		ReadPosition operator*() const
-		{
-			size_t globPos = rv.data[index].get();
-			FastaRecord::Id seqId;
-			int32_t position;
-			int32_t seqLen;
-			seqContainer.seqPosition(globPos, seqId, position, seqLen);
-
-			if (!revComp)
-			{
-				return ReadPosition(seqId, position);
-			}
-			else
-			{
-				return ReadPosition(seqId.rc(), seqLen - position - kmerSize);
-			}
-		}
-
-		KmerPosIterator& operator++()
-		{
-			++index;
-			return *this;
-		}
-	
-	private:
-		ReadVector rv;
-		size_t index;
-		bool   revComp;
-		const  SequenceContainer& seqContainer;
-		size_t kmerSize;
-	};
-
-	class IterHelper
+	struct ReadPosition
 	{
-	public:
-		IterHelper(ReadVector rv, bool revComp, 
-				   const SequenceContainer& seqContainer): 
-			rv(rv), revComp(revComp), seqContainer(seqContainer) {}
-
-		KmerPosIterator begin()
-		{
-			return KmerPosIterator(rv, 0, revComp, seqContainer);
-		}
-
-		KmerPosIterator end()
-		{
-			return KmerPosIterator(rv, rv.size, revComp, seqContainer);
-		}
-
-	private:
-		ReadVector rv;
-		bool revComp;
-		const SequenceContainer& seqContainer;
+		ReadPosition(FastaRecord::Id readId = FastaRecord::ID_NONE, 
+					 int32_t position = 0):
+			readId(readId), position(position) {}
+		FastaRecord::Id readId;
+		int32_t position;
 	};
 
 	void countKmers();
+	//counts the k-mers of the sequences as they are passed, 
+	//for example while they are being loaded
+	void startCountingKmers();
+	void addKmerSequence(const DnaSequence& sequence)
+	{
+		_kmerCounter.addSequence(sequence);
+	}
+	void finishCountingKmers();
 	void buildIndex(int minCoverage);
 	void buildIndexUnevenCoverage(int minCoverage, float selectRate, 
 								  int tandemFreq);
 	void buildIndexMinimizers(int minCoverage, int wndLen);
 	void clear();
 
-	IterHelper iterKmerPos(Kmer kmer) const
+	//For the partitioned indexing: sets the repeat cutoff from the global
+	//k-mer counts (instead of the frequencies in the indexed partition).
+	//The counts and the cutoff are then kept by clearIndex(), so every
+	//partition is indexed with the same ones
+	void setGlobalRepeatCutoff(int minCoverage, float rate);
+	//frees the index, but keeps the k-mer counts if the cutoff is global
+	void clearIndex();
+
+	//Restricts the next index construction to the given (forward strand)
+	//sequences and their complements. Empty vector means all sequences.
+	//K-mer counting is not affected and is always global
+	void setIndexedSequences(const std::vector<FastaRecord::Id>& seqIds)
 	{
-		bool revComp = kmer.standardForm();
-		return IterHelper(_kmerIndex.find(kmer), revComp,
-						  _seqContainer);
+		_indexedSeqs = seqIds;
 	}
 
 	//__attribute__((always_inline))
@@ -231,6 +227,10 @@ public:
 		return _kmerIndex.contains(kmer);
 	}*/
 
+	//Outputs all positions of the k-mer at once, works with
+	//both plain and compressed index. Returns the number of positions
+	size_t decodeKmerPos(Kmer kmer, std::vector<ReadPosition>& out) const;
+
 	bool isRepetitive(Kmer kmer) const
 	{
 		kmer.standardForm();
@@ -251,6 +251,12 @@ public:
 		_kmerCounter.setOutputProgress(set);
 	}
 
+	//where k-mer counting could keep temporary data
+	void setTempDirectory(const std::string& dir)
+	{
+		_kmerCounter.setTempDirectory(dir);
+	}
+
 	const KmerDistribution& getKmerHist() const
 	{
 		return _kmerCounter.getKmerHist();
@@ -259,6 +265,10 @@ public:
 
 	float getSampleRate() const {return _sampleRate;}
 
+	//if the index was built from homopolymer-compressed seeds,
+	//the queries should use yieldHpcSeeds() as well
+	bool hpcSeeds() const {return _hpcSeeds;}
+
 private:
 	//void setRepeatCutoff(int minCoverage);
 
@@ -273,18 +283,32 @@ private:
 		yieldFrequentKmers(const FastaRecord::Id& seqId,
 						   float selctRate, int tandemFreq);
 
+	std::vector<FastaRecord::Id> indexedSeqs() const;
 	void allocateIndexMemory();
+	void finalizeIndex();
+	void compressIndex();
 	void filterFrequentKmers(int minCoverage, float rate);
+	void logSeedStatistics(std::function<std::vector<KmerPosition>
+								(const FastaRecord::Id&)> yieldSeeds,
+						   const std::vector<FastaRecord::Id>& seqIds);
+	void buildIndexSorted(std::function<std::vector<KmerPosition>
+								(const FastaRecord::Id&)> yieldKmers,
+						  int minCoverage, float rate, bool filterByGlobalFreq);
 
 	const SequenceContainer& _seqContainer;
 	//KmerDistribution 		 _kmerDistribution;
 	bool    _outputProgress;
 	float   _sampleRate;
 	size_t  _repetitiveFrequency;
+	bool    _globalRepeatCutoff;
 	//int32_t _solidMultiplier;
 
 	const size_t MEM_CHUNK = 32 * 1024 * 1024 / sizeof(IndexChunk);
 	std::vector<IndexChunk*> _memoryChunks;
+	std::vector<uint8_t*> 	 _packedChunks;
+	bool 					 _compressed;
+	bool 					 _hpcSeeds;
+	std::vector<FastaRecord::Id> _indexedSeqs;
 
 	cuckoohash_map<Kmer, ReadVector> _kmerIndex;
 	//cuckoohash_map<Kmer, size_t> 	 _kmerCounts;